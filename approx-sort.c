@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
+#include <error.h>
+#include <unistd.h>
 
 #include "softheap.h"
+#include "sweep.h"
 
 /* --------------- Metrics ------------------ */
 
@@ -26,17 +30,94 @@ long metric_distance(int *output, int n) {
   return dist;
 }
 
-//Kendall tau distance. Equivalent to number of pairs in wrong order.
+/* Sort A[l..r) by merging, using aux[l..r) as scratch, and return the number
+ * of inversions (pairs i < j with A[i] > A[j]) it contained. */
+static long count_inversions(int *A, int *aux, int l, int r) {
+  if(r - l < 2) return 0;
+  int q = l + (r - l) / 2;
+  long count = count_inversions(A, aux, l, q) + count_inversions(A, aux, q, r);
+
+  // Every element taken from the right half jumps over all remaining left ones
+  int i = l, j = q, pos = l;
+  while(i < q && j < r) {
+    if(A[i] <= A[j]) aux[pos++] = A[i++];
+    else {
+      aux[pos++] = A[j++];
+      count += q - i;
+    }
+  }
+  while(i < q) aux[pos++] = A[i++];
+  while(j < r) aux[pos++] = A[j++];
+  memcpy(A + l, aux + l, (r - l) * sizeof(int));
+  return count;
+}
+
+//Number of pairs in wrong order, counted in O(n log n) by merge sort.
+long metric_inversions(int *output, int n) {
+  int *copy = malloc(n * sizeof(int)), *aux = malloc(n * sizeof(int));
+  if(copy == NULL || aux == NULL) error(1,0, "out of memory counting inversions");
+  memcpy(copy, output, n * sizeof(int));
+  long count = count_inversions(copy, aux, 0, n);
+  free(copy);
+  free(aux);
+  return count;
+}
+
+//Kendall tau distance. Equivalent to number of pairs in wrong order,
+//normalized by the number of pairs.
 double metric_kendall(int *output, int n) {
-  long count = 0;
+  return 2*metric_inversions(output, n) / (n*(n-1.0));
+}
+
+//Spearman footrule: the total displacement metric_distance, normalized by
+//its maximum floor(n^2/2) (attained by the reversed order).
+double metric_footrule(int *output, int n) {
+  return metric_distance(output, n) / floor(n*(double)n/2);
+}
+
+//Largest distance of any element from its sorted position.
+int metric_max_displacement(int *output, int n) {
+  int maxdisp = 0;
+  for(int i = 0; i < n; i++) {
+    int disp = (output[i] > i ? output[i] - i : i - output[i]);
+    if(disp > maxdisp) maxdisp = disp;
+  }
+
+  return maxdisp;
+}
+
+//Number of maximal ascending runs; 1 for sorted output.
+int metric_runs(int *output, int n) {
+  int runs = (n > 0);
+  for(int i = 1; i < n; i++) {
+    if(output[i] < output[i-1])
+      runs++;
+  }
+
+  return runs;
+}
+
+//Length of the longest increasing subsequence, by patience sorting: tops[k]
+//is the smallest element ending an increasing subsequence of length k+1.
+int metric_lis(int *output, int n) {
+  int *tops = malloc(n * sizeof(int));
+  if(tops == NULL) error(1,0, "out of memory computing LIS");
+
+  int npiles = 0;
   for(int i = 0; i < n; i++) {
-    for(int j = i+1; j < n; j++) {
-      if(output[i] > output[j])
-        count++;
+    // Leftmost pile whose top is >= output[i]
+    int lo = 0, hi = npiles;
+    while(lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      if(tops[mid] < output[i]) lo = mid + 1;
+      else hi = mid;
     }
+    tops[lo] = output[i];
+    if(lo == npiles) npiles++;
   }
 
-  return 2*count / (n*(n-1.0));
+  free(tops);
+  return npiles;
 }
 
 double metric_mispositions_threshold(int *output, int n, int threshold) {
@@ -52,25 +133,71 @@ double metric_mispositions_threshold(int *output, int n, int threshold) {
 
 /* --------------- Test -------------------- */
 
-void all_metrics_per_epsilon(int *elts, int n) {
-  int output[n];
-
-  for(int k = 1; k < n; k *= 2) {
-    double epsilon = ((double)k)/n;
-    int r = ceil(-log(epsilon)/log(2)) + 5;
-
-    softheap *P = makeheap_empty(epsilon);
+/* Metrics for one epsilon, computed on a sweep worker with its own heap and
+ * output buffer, and printed in order by the calling thread. */
+typedef struct {
+  int r;
+  double mispos, mispos_threshold, kendall, footrule;
+  long distance;
+  int maxdisp, runs, lis;
+} epsilon_metrics;
+
+typedef struct {
+  int *elts;
+  int n;
+  epsilon_metrics *results;
+} metrics_sweep;
+
+void metrics_for_epsilon(int step, void *ctx) {
+  metrics_sweep *sw = ctx;
+  int n = sw->n;
+  double epsilon = ((double)(1 << step))/n;
+  epsilon_metrics *m = &sw->results[step];
+  m->r = ceil(-log(epsilon)/log(2)) + 5;
+
+  int *output = malloc(n * sizeof(int));
+  if(output == NULL) error(1,0, "out of memory allocating output");
+
+  softheap *P = makeheap_empty(epsilon);
+
+  for(int i = 0; i < n; i++)
+    insert(P, sw->elts[i]);
+
+  for(int i = 0; i < n; i++)
+    output[i] = extract_min(P);
+
+  destroy_heap(P);
+
+  m->mispos = metric_mispositions(output,n);
+  m->distance = metric_distance(output,n);
+  m->mispos_threshold = metric_mispositions_threshold(output,n,n/100);
+  m->kendall = metric_kendall(output,n);
+  m->footrule = metric_footrule(output,n);
+  m->maxdisp = metric_max_displacement(output,n);
+  m->runs = metric_runs(output,n);
+  m->lis = metric_lis(output,n);
+  free(output);
+}
 
-    for(int i = 0; i < n; i++)
-      insert(P, elts[i]);
+void print_metrics(int i, void *ctx) {
+  epsilon_metrics *m = &((metrics_sweep *)ctx)->results[i];
+  printf("r=%d \t\t %f \t\t %ld \t\t %f \t\t %f \t\t %f \t\t %d \t\t %d \t\t %d \n", m->r,
+         m->mispos, m->distance, m->mispos_threshold, m->kendall, m->footrule, m->maxdisp, m->runs,
+         m->lis);
+  fflush(stdout);
+}
 
-    for(int i = 0; i < n; i++)
-      output[i] = extract_min(P);
+void all_metrics_per_epsilon(int *elts, int n, int nthreads) {
+  int count = 0;
+  for(int k = 1; k < n; k *= 2) count++;
 
-    destroy_heap(P);
+  metrics_sweep sw = { elts, n, malloc(count * sizeof(epsilon_metrics)) };
+  if(sw.results == NULL) error(1,0, "out of memory allocating results");
 
-    printf("r=%d \t\t %f \t\t %ld \t\t %f \n", r, metric_mispositions(output,n),metric_distance(output,n),metric_mispositions_threshold(output,n,n/100));
-  }
+  printf("r \t\t mispos \t\t distance \t\t mispos>n/100 \t\t kendall \t\t footrule "
+         "\t\t maxdisp \t\t runs \t\t lis\n");
+  sweep_run(count, nthreads, metrics_for_epsilon, print_metrics, &sw);
+  free(sw.results);
 }
 
 //Uniform in [0,k). Not perfect, but should be ok...
@@ -89,14 +216,23 @@ void random_permutation(int *elts, int n) {
 
 
 int main(int argc, char *argv[]) {
-  int n = 1000000;
+  // Each epsilon runs on its own thread with its own heap; -j limits how many at once
+  int nthreads = sweep_default_threads(), opt;
+  while((opt = getopt(argc, argv, "j:")) != -1) {
+    if(opt == 'j') nthreads = atoi(optarg);
+    else error(1,0, "usage: ./approx-sort [-j threads] [n >= 2]");
+  }
+  int n = (optind < argc ? atoi(argv[optind]) : 1000000);
+  if(n < 2) error(1,0, "usage: ./approx-sort [-j threads] [n >= 2]");
 
-  int elts[n];
+  int *elts = malloc(n * sizeof(int));
+  if(elts == NULL) error(1,0, "out of memory allocating elements");
 
   srand(time(NULL));
   random_permutation(elts, n);
 
-  all_metrics_per_epsilon(elts, n);
+  all_metrics_per_epsilon(elts, n, nthreads);
 
+  free(elts);
   return 0;
 }
@@ -0,0 +1,392 @@
+/* File: bench.c
+ * -------------
+ * Implementation of the shared benchmark harness. See bench.h.
+ */
+
+#define _GNU_SOURCE // for sched_setaffinity and CPU_SET
+#include "bench.h"
+#include "perfctr.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <error.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // for __rdtsc
+#endif
+
+/******************************************** CLOCKS ****************************************/
+
+uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t bench_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**************************************** CONFIGURATION **************************************/
+
+void bench_default_config(bench_config *cfg) {
+  cfg->warmup = 1;
+  cfg->min_reps = 5;
+  cfg->max_reps = 50;
+  cfg->max_rel_ci = 0.02;
+  cfg->max_secs = 10;
+  cfg->cpu = -1;
+  cfg->perf = false;
+  cfg->format = BENCH_TEXT;
+  cfg->out = stdout;
+}
+
+void bench_usage(FILE *f) {
+  fprintf(f, "harness options:\n"
+             "  -f text|csv|json  output format (default text)\n"
+             "  -w N              warmup repetitions (default 1)\n"
+             "  -r N              minimum repetitions (default 5)\n"
+             "  -R N              maximum repetitions (default 50)\n"
+             "  -e X              target relative 95%% CI half-width (default 0.02)\n"
+             "  -t SECS           time budget per measurement (default 10)\n"
+             "  -c CPU            pin to CPU (default: no pinning)\n"
+             "  -p                report hardware performance counters per operation\n");
+}
+
+int bench_parse_options(bench_config *cfg, int argc, char *argv[], const char *extra_opts,
+                        void (*extra)(int opt, const char *arg, void *ctx), void *ctx) {
+  char optstring[64] = "f:w:r:R:e:t:c:ph";
+  if(extra_opts != NULL) strncat(optstring, extra_opts, sizeof(optstring) - strlen(optstring) - 1);
+
+  int opt;
+  while((opt = getopt(argc, argv, optstring)) != -1) {
+    switch(opt) {
+    case 'f':
+      if(strcmp(optarg, "text") == 0) cfg->format = BENCH_TEXT;
+      else if(strcmp(optarg, "csv") == 0) cfg->format = BENCH_CSV;
+      else if(strcmp(optarg, "json") == 0) cfg->format = BENCH_JSON;
+      else error(1,0, "unknown output format '%s'", optarg);
+      break;
+    case 'w': cfg->warmup = atoi(optarg); break;
+    case 'r': cfg->min_reps = atoi(optarg); break;
+    case 'R': cfg->max_reps = atoi(optarg); break;
+    case 'e': cfg->max_rel_ci = atof(optarg); break;
+    case 't': cfg->max_secs = atof(optarg); break;
+    case 'c': cfg->cpu = atoi(optarg); break;
+    case 'p': cfg->perf = true; break;
+    case 'h':
+      bench_usage(stderr);
+      exit(0);
+    case '?':
+      bench_usage(stderr);
+      exit(1);
+    default:
+      if(extra == NULL) error(1,0, "unhandled option -%c", opt);
+      extra(opt, optarg, ctx);
+    }
+  }
+
+  if(cfg->min_reps < 1) cfg->min_reps = 1;
+  if(cfg->max_reps < cfg->min_reps) cfg->max_reps = cfg->min_reps;
+  if(cfg->warmup < 0) cfg->warmup = 0;
+  if(cfg->cpu >= 0 && !bench_pin_cpu(cfg->cpu))
+    fprintf(stderr, "warning: could not pin to CPU %d, continuing unpinned\n", cfg->cpu);
+  return optind;
+}
+
+bool bench_pin_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+/******************************************** MEMORY ****************************************/
+
+#define HUGE_PAGE (2ul << 20)
+
+void *bench_alloc(size_t bytes) {
+  // Map an extra huge page's worth so that we can trim the mapping to a
+  // 2 MB-aligned range; the kernel can only back aligned ranges with huge pages.
+  size_t len = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+  if(len == 0) len = HUGE_PAGE;
+  char *raw = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(raw == MAP_FAILED) error(1,0, "out of memory mapping %zu bytes", bytes);
+
+  char *p = (char *)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+  if(p > raw) munmap(raw, p - raw);
+  if(raw + HUGE_PAGE > p) munmap(p + len, raw + HUGE_PAGE - p);
+#ifdef MADV_HUGEPAGE
+  madvise(p, len, MADV_HUGEPAGE); // only a hint; fine if THP is disabled
+#endif
+  return p;
+}
+
+void bench_free(void *p, size_t bytes) {
+  if(p == NULL) return;
+  size_t len = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+  munmap(p, len > 0 ? len : HUGE_PAGE);
+}
+
+/* Read the first line of path starting with key, and return the number
+ * that follows it (in kB for the /proc files we use), or 0. */
+static size_t proc_field_kb(const char *path, const char *key) {
+  char line[256];
+  size_t kb = 0, keylen = strlen(key);
+  FILE *f = fopen(path, "r");
+  if(f == NULL) return 0;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    if(strncmp(line, key, keylen) == 0) {
+      kb = strtoull(line + keylen, NULL, 10);
+      break;
+    }
+  }
+  fclose(f);
+  return kb;
+}
+
+size_t bench_available_memory(void) {
+  size_t kb = proc_field_kb("/proc/meminfo", "MemAvailable:");
+  if(kb == 0) return (size_t)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  return kb * 1024;
+}
+
+size_t bench_rss(void) {
+  return proc_field_kb("/proc/self/status", "VmRSS:") * 1024;
+}
+
+size_t bench_peak_rss(void) {
+  return proc_field_kb("/proc/self/status", "VmHWM:") * 1024;
+}
+
+bool bench_reset_peak_rss(void) {
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if(f == NULL) return false;
+  bool ok = (fputs("5", f) >= 0);
+  return (fclose(f) == 0 && ok);
+}
+
+/******************************************** STATISTICS ****************************************/
+
+/* Callback comparing two doubles for qsort. */
+static int doublecmp(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Two-sided 95% quantile of Student's t distribution with df degrees of freedom.
+ * Small sample counts are common when each repetition is expensive, so the
+ * normal approximation would make the confidence interval look too tight. */
+static double t95(int df) {
+  static const double table[] = { 0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                  2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110,
+                                  2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056,
+                                  2.052, 2.048, 2.045, 2.042 };
+  if(df < 1) return INFINITY;
+  if(df <= 30) return table[df];
+  return 1.96;
+}
+
+/* Value at quantile q (in [0,1]) of the sorted array xs of length n,
+ * using the nearest-rank definition. */
+static double quantile(const double *xs, int n, double q) {
+  int idx = (int)ceil(q * n) - 1;
+  if(idx < 0) idx = 0;
+  if(idx >= n) idx = n - 1;
+  return xs[idx];
+}
+
+/* Fill the summary fields of res from the n raw samples in xs (sorting xs). */
+static void summarize(double *xs, double *cycles, int n, bench_result *res) {
+  double sum = 0, sumsq = 0;
+  for(int i = 0; i < n; i++) sum += xs[i];
+  double mean = sum / n;
+  for(int i = 0; i < n; i++) sumsq += (xs[i] - mean) * (xs[i] - mean);
+
+  qsort(xs, n, sizeof(double), doublecmp);
+  qsort(cycles, n, sizeof(double), doublecmp);
+
+  res->reps = n;
+  res->mean = mean;
+  res->stddev = (n > 1 ? sqrt(sumsq / (n - 1)) : 0);
+  res->ci95 = (n > 1 ? t95(n - 1) * res->stddev / sqrt(n) : INFINITY);
+  res->median = (n % 2 == 1 ? xs[n/2] : (xs[n/2 - 1] + xs[n/2]) / 2);
+  res->p95 = quantile(xs, n, 0.95);
+  res->min = xs[0];
+  res->max = xs[n-1];
+  res->cycles_median = cycles[n/2];
+  res->per_op = (res->ops > 0 ? res->median / res->ops : res->median);
+}
+
+/******************************************** RUNNING ****************************************/
+
+/* Perform one repetition of the benchmark, returning its duration in ns
+ * and storing its TSC delta in cycles_into. If pc is non-NULL, the hardware
+ * counters are run around the timed body and added into totals. */
+static double run_once(const bench_ops *ops, void *ctx, double *cycles_into,
+                       perfctrs *pc, perf_sample *totals) {
+  if(ops->setup != NULL) ops->setup(ctx);
+  if(pc != NULL) perfctr_start(pc);
+  uint64_t c0 = bench_cycles();
+  uint64_t t0 = bench_now_ns();
+  ops->run(ctx);
+  uint64_t t1 = bench_now_ns();
+  uint64_t c1 = bench_cycles();
+  if(pc != NULL) {
+    perf_sample s;
+    perfctr_stop(pc, &s);
+    for(int i = 0; i < PC_NCOUNTERS; i++) {
+      totals->value[i] += s.value[i];
+      totals->valid[i] = totals->valid[i] && s.valid[i];
+    }
+  }
+  if(ops->teardown != NULL) ops->teardown(ctx);
+
+  *cycles_into = (double)(c1 - c0);
+  return (double)(t1 - t0);
+}
+
+void bench_run(const bench_config *cfg, const bench_ops *ops, void *ctx, long ops_per_rep,
+               bench_result *res) {
+  memset(res, 0, sizeof(*res));
+  res->ops = ops_per_rep;
+
+  double ignored;
+  for(int i = 0; i < cfg->warmup; i++) run_once(ops, ctx, &ignored, NULL, NULL);
+
+  // Open the hardware counters if asked, falling back to timing alone
+  static bool warned = false;
+  perfctrs counters, *pc = NULL;
+  perf_sample totals;
+  if(cfg->perf) {
+    if(perfctr_open(&counters)) pc = &counters;
+    else if(!__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED)) // once, even across sweep threads
+      fprintf(stderr, "warning: hardware performance counters unavailable\n");
+    for(int i = 0; i < PC_NCOUNTERS; i++) {
+      totals.value[i] = 0;
+      totals.valid[i] = true;
+    }
+  }
+
+  double *samples = malloc(cfg->max_reps * sizeof(double));
+  double *cycles = malloc(cfg->max_reps * sizeof(double));
+  if(samples == NULL || cycles == NULL) error(1,0, "out of memory allocating benchmark samples");
+
+  // Keep a running mean/variance (Welford) so the stopping rule is O(1) per repetition
+  double mean = 0, m2 = 0, budget_ns = cfg->max_secs * 1e9;
+  uint64_t start = bench_now_ns();
+  int n = 0;
+  while(n < cfg->max_reps) {
+    double x = run_once(ops, ctx, &cycles[n], pc, &totals);
+    samples[n++] = x;
+
+    double delta = x - mean;
+    mean += delta / n;
+    m2 += delta * (x - mean);
+
+    if(n < cfg->min_reps) continue;
+    if(bench_now_ns() - start > budget_ns) break;
+    double halfwidth = (n > 1 ? t95(n - 1) * sqrt(m2 / (n - 1)) / sqrt(n) : INFINITY);
+    if(mean <= 0 || halfwidth / mean <= cfg->max_rel_ci) break;
+  }
+
+  summarize(samples, cycles, n, res);
+  free(samples);
+  free(cycles);
+
+  if(pc != NULL) {
+    perfctr_add_metrics(&totals, (double)n * (ops_per_rep > 0 ? ops_per_rep : 1), res);
+    perfctr_close(pc);
+  }
+}
+
+void bench_add_metric(bench_result *res, const char *key, double value) {
+  if(res->nmetrics >= BENCH_MAX_METRICS) error(1,0, "too many metrics attached to one result");
+  res->metrics[res->nmetrics].key = key;
+  res->metrics[res->nmetrics].value = value;
+  res->nmetrics++;
+}
+
+/******************************************** REPORTING ****************************************/
+
+void bench_report_begin(const bench_config *cfg) {
+  if(cfg->format == BENCH_CSV)
+    fprintf(cfg->out, "suite,name,param,n,reps,ops,median_ns,p95_ns,mean_ns,min_ns,max_ns,"
+                      "stddev_ns,ci95_ns,per_op_ns,median_cycles,metrics\n");
+}
+
+/* Print s as a JSON string literal. Our names never contain control
+ * characters, so only quotes and backslashes need escaping. */
+static void json_string(FILE *f, const char *s) {
+  fputc('"', f);
+  for(; s != NULL && *s != '\0'; s++) {
+    if(*s == '"' || *s == '\\') fputc('\\', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+void bench_report(const bench_config *cfg, const char *suite, const char *name,
+                  const char *param, long n, const bench_result *res) {
+  FILE *f = cfg->out;
+  if(param == NULL) param = "";
+
+  // A single repetition has no confidence interval: leave the CSV field
+  // empty, write null in JSON rather than inf and n/a in text
+  char ci95[32] = "";
+  if(res->reps >= 2) snprintf(ci95, sizeof(ci95), "%.1f", res->ci95);
+  else if(cfg->format == BENCH_JSON) strcpy(ci95, "null");
+
+  switch(cfg->format) {
+  case BENCH_TEXT:
+    fprintf(f, "%-16s %-20s %-18s n=%-10ld median %12.0f ns  p95 %12.0f ns  "
+               "%9.2f ns/op  (%d reps, ci95 ",
+            suite, name, param, n, res->median, res->p95, res->per_op, res->reps);
+    if(res->reps >= 2) fprintf(f, "%.1f%%)", res->mean > 0 ? 100 * res->ci95 / res->mean : 0);
+    else fprintf(f, "n/a)");
+    for(int i = 0; i < res->nmetrics; i++)
+      fprintf(f, "  %s=%.6g", res->metrics[i].key, res->metrics[i].value);
+    fprintf(f, "\n");
+    break;
+
+  case BENCH_CSV:
+    fprintf(f, "%s,%s,%s,%ld,%d,%ld,%.0f,%.0f,%.1f,%.0f,%.0f,%.1f,%s,%.3f,%.0f,", suite, name,
+            param, n, res->reps, res->ops, res->median, res->p95, res->mean, res->min, res->max,
+            res->stddev, ci95, res->per_op, res->cycles_median);
+    for(int i = 0; i < res->nmetrics; i++)
+      fprintf(f, "%s%s=%.6g", i ? ";" : "", res->metrics[i].key, res->metrics[i].value);
+    fprintf(f, "\n");
+    break;
+
+  case BENCH_JSON:
+    fprintf(f, "{\"suite\":");
+    json_string(f, suite);
+    fprintf(f, ",\"name\":");
+    json_string(f, name);
+    fprintf(f, ",\"param\":");
+    json_string(f, param);
+    fprintf(f, ",\"n\":%ld,\"reps\":%d,\"ops\":%ld,\"median_ns\":%.0f,\"p95_ns\":%.0f,"
+               "\"mean_ns\":%.1f,\"min_ns\":%.0f,\"max_ns\":%.0f,\"stddev_ns\":%.1f,"
+               "\"ci95_ns\":%s,\"per_op_ns\":%.3f,\"median_cycles\":%.0f,\"metrics\":{",
+            n, res->reps, res->ops, res->median, res->p95, res->mean, res->min, res->max,
+            res->stddev, ci95, res->per_op, res->cycles_median);
+    for(int i = 0; i < res->nmetrics; i++) {
+      if(i) fputc(',', f);
+      json_string(f, res->metrics[i].key);
+      fprintf(f, ":%.6g", res->metrics[i].value);
+    }
+    fprintf(f, "}}\n");
+    break;
+  }
+  fflush(f);
+}
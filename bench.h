@@ -0,0 +1,206 @@
+/* File: bench.h
+ * -------------
+ * Shared benchmark harness for the timing drivers. A benchmark is described
+ * by a set of callbacks (untimed setup, timed run, untimed teardown) that
+ * the harness repeats after a warmup until the 95% confidence interval of the
+ * mean is tight enough or a repetition/time budget runs out. Timing uses
+ * CLOCK_MONOTONIC, with the TSC recorded alongside on x86. Results are
+ * summarized as median/p95/etc. and reported as human-readable text, CSV,
+ * or JSON lines so that dashboards can ingest them directly.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Output formats understood by bench_report. */
+typedef enum { BENCH_TEXT, BENCH_CSV, BENCH_JSON } bench_format;
+
+/* Knobs controlling how many times a benchmark is repeated and how the
+ * results are written out. Filled with defaults by bench_default_config
+ * and overridden from the command line by bench_parse_options. */
+typedef struct {
+  int warmup;          // untimed repetitions before measuring
+  int min_reps;        // always measure at least this many repetitions
+  int max_reps;        // never measure more than this many repetitions
+  double max_rel_ci;   // stop once the 95% CI half-width / mean drops below this
+  double max_secs;     // stop once this much time has been spent measuring
+  int cpu;             // CPU to pin the benchmark thread to, or -1 for none
+  bool perf;           // also count hardware events around each timed run
+  bench_format format;
+  FILE *out;
+} bench_config;
+
+/* Maximum number of extra named metrics a result can carry. */
+#define BENCH_MAX_METRICS 32
+
+/* Summary of a measured benchmark. Times are in nanoseconds per
+ * repetition; per_op divides the median by the number of operations
+ * performed in one repetition. Extra metrics (counters, memory, ...)
+ * can be attached with bench_add_metric and are reported verbatim. */
+typedef struct {
+  int reps;
+  long ops;
+  double mean, median, p95, min, max, stddev, ci95;
+  double per_op;
+  double cycles_median;
+  int nmetrics;
+  struct { const char *key; double value; } metrics[BENCH_MAX_METRICS];
+} bench_result;
+
+/* A benchmark body. setup and teardown are optional and untimed; run is
+ * timed. All three receive the same client context pointer. */
+typedef void (*bench_fn)(void *ctx);
+
+typedef struct {
+  bench_fn setup, run, teardown;
+} bench_ops;
+
+/**
+ * Function: bench_now_ns
+ * ----------------------
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * Function: bench_cycles
+ * ----------------------
+ * Returns the time stamp counter on x86 and 0 elsewhere.
+ */
+uint64_t bench_cycles(void);
+
+/**
+ * Function: bench_default_config
+ * ------------------------------
+ * Fills cfg with the default repetition policy: 1 warmup, 5 to 50
+ * repetitions, 2% relative confidence interval, 10 s budget, no pinning,
+ * no hardware counters, text output on stdout.
+ */
+void bench_default_config(bench_config *cfg);
+
+/**
+ * Function: bench_parse_options
+ * -----------------------------
+ * Parses the harness's command-line options into cfg and returns the index
+ * of the first non-option argument. Recognized options are
+ *   -f text|csv|json   output format
+ *   -w N               warmup repetitions
+ *   -r N / -R N        minimum / maximum repetitions
+ *   -e X               target relative confidence interval
+ *   -t SECS            time budget per measurement
+ *   -c CPU             pin to the given CPU
+ *   -p                 count hardware events (see perfctr.h)
+ * Extra driver-specific option letters may be passed in extra_opts (getopt
+ * syntax); each one found is handed to the callback along with its argument.
+ */
+int bench_parse_options(bench_config *cfg, int argc, char *argv[], const char *extra_opts,
+                        void (*extra)(int opt, const char *arg, void *ctx), void *ctx);
+
+/**
+ * Function: bench_usage
+ * ---------------------
+ * Prints a description of the harness's options to f.
+ */
+void bench_usage(FILE *f);
+
+/**
+ * Function: bench_pin_cpu
+ * -----------------------
+ * Pins the calling thread to the given CPU. Returns false (and leaves
+ * the affinity unchanged) if that is not possible.
+ */
+bool bench_pin_cpu(int cpu);
+
+/**
+ * Function: bench_alloc
+ * ---------------------
+ * Allocates bytes of zeroed memory straight from the kernel with mmap,
+ * aligned to 2 MB and advised to use transparent huge pages, so that large
+ * benchmark buffers do not pay for 4 KB TLB misses. Exits on failure.
+ * Release the memory with bench_free and the same size.
+ */
+void *bench_alloc(size_t bytes);
+
+/**
+ * Function: bench_free
+ * --------------------
+ * Releases memory obtained from bench_alloc.
+ */
+void bench_free(void *p, size_t bytes);
+
+/**
+ * Function: bench_available_memory
+ * --------------------------------
+ * Returns the number of bytes the kernel reports can still be allocated
+ * without swapping (MemAvailable).
+ */
+size_t bench_available_memory(void);
+
+/**
+ * Function: bench_rss
+ * -------------------
+ * Returns the resident set size of this process in bytes.
+ */
+size_t bench_rss(void);
+
+/**
+ * Function: bench_peak_rss
+ * ------------------------
+ * Returns the peak resident set size in bytes since the process started or
+ * since the last bench_reset_peak_rss, whichever is later.
+ */
+size_t bench_peak_rss(void);
+
+/**
+ * Function: bench_reset_peak_rss
+ * ------------------------------
+ * Resets the peak resident set size to the current one. Returns false if the
+ * kernel does not allow it, in which case bench_peak_rss keeps reporting the
+ * peak over the whole run.
+ */
+bool bench_reset_peak_rss(void);
+
+/**
+ * Function: bench_run
+ * -------------------
+ * Measures the benchmark described by ops and ctx according to cfg and
+ * stores the summary in res. ops_per_rep is the number of operations one
+ * call of ops->run performs and is used to compute per_op. If cfg->perf is
+ * set, hardware counters are summed over the timed runs (setup and teardown
+ * excluded) and attached to res per operation; counters the machine cannot
+ * provide are left out with a one-time warning.
+ */
+void bench_run(const bench_config *cfg, const bench_ops *ops, void *ctx, long ops_per_rep,
+               bench_result *res);
+
+/**
+ * Function: bench_add_metric
+ * --------------------------
+ * Attaches an extra named value to a result. The key must outlive the result.
+ */
+void bench_add_metric(bench_result *res, const char *key, double value);
+
+/**
+ * Function: bench_report_begin
+ * ----------------------------
+ * Writes whatever preamble the configured format needs (the CSV header).
+ * Call once before the first bench_report.
+ */
+void bench_report_begin(const bench_config *cfg);
+
+/**
+ * Function: bench_report
+ * ----------------------
+ * Writes one result. suite names the driver/benchmark family, name the
+ * engine or algorithm measured, param the configuration (e.g. "eps=0.01"),
+ * and n the problem size.
+ */
+void bench_report(const bench_config *cfg, const char *suite, const char *name,
+                  const char *param, long n, const bench_result *res);
+
+#endif // BENCH_H
@@ -80,6 +80,27 @@ void build_minheap(int *A, size_t length) {
   for(int i = length/2 - 1; i >= 0; i--) min_heapify(A, length, i);
 }
 
+/* Add elem to the min-heap A[0..heapsize-1], which must have room for one
+ * more element, by placing it at the end and bubbling it up past any
+ * larger parents. */
+void min_heap_insert(int *A, size_t heapsize, int elem) {
+  size_t i = heapsize;
+  A[i] = elem;
+  while(i > 0 && A[parent(i)] > A[i]) {
+    swap(A, i, parent(i));
+    i = parent(i);
+  }
+}
+
+/* Remove and return the minimum of the nonempty min-heap A[0..heapsize-1]
+ * by moving the last element to the root and min-heapifying it down. */
+int min_heap_extract(int *A, size_t heapsize) {
+  int min = A[0];
+  A[0] = A[heapsize - 1];
+  min_heapify(A, heapsize - 1, 0);
+  return min;
+}
+
 
 
 
@@ -0,0 +1,23 @@
+/* File: binheap.h
+ * ---------------
+ * Prototypes for the array-based binary heap routines in binheap.c, for
+ * clients that link against libheaps rather than including binheap.c.
+ */
+
+#ifndef BINHEAP_H
+#define BINHEAP_H
+
+#include <stddef.h>
+
+size_t parent(size_t i);
+size_t left(size_t i);
+size_t right(size_t i);
+void swap(int *A, size_t i, size_t j);
+void max_heapify(int *A, size_t heapsize, size_t i);
+void min_heapify(int *A, size_t heapsize, int i);
+void build_maxheap(int *A, size_t length);
+void build_minheap(int *A, size_t length);
+void min_heap_insert(int *A, size_t heapsize, int elem);
+int min_heap_extract(int *A, size_t heapsize);
+
+#endif // BINHEAP_H
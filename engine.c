@@ -0,0 +1,120 @@
+/* File: engine.c
+ * --------------
+ * Engine tables for the priority queues we benchmark. See engine.h.
+ */
+
+#include "engine.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <error.h>
+
+#include "softheap.h"
+#include "binheap.h"
+
+/******************************************** SOFT HEAP ****************************************/
+
+static void *sh_create(double epsilon) {
+  return makeheap_empty(epsilon);
+}
+
+static void sh_destroy(void *pq) {
+  destroy_heap(pq);
+}
+
+static void sh_insert(void *pq, int key) {
+  insert(pq, key);
+}
+
+static int sh_extract(void *pq) {
+  return extract_min(pq);
+}
+
+static void *sh_meld(void *p, void *q) {
+  return meld(p, q);
+}
+
+static bool sh_empty(void *pq) {
+  return empty(pq);
+}
+
+const pq_engine softheap_engine = {
+  "softheap", true, sh_create, sh_destroy, sh_insert, sh_extract, sh_meld, sh_empty
+};
+
+/******************************************** BINARY HEAP ****************************************/
+
+/* A binary min-heap in a growable array. */
+typedef struct {
+  int *A;
+  size_t n, cap;
+} binheap;
+
+/* Make room for at least need elements, doubling the capacity as necessary. */
+static void bh_reserve(binheap *h, size_t need) {
+  if(need <= h->cap) return;
+  size_t cap = (h->cap > 0 ? h->cap : 16);
+  while(cap < need) cap *= 2;
+  h->A = realloc(h->A, cap * sizeof(int));
+  if(h->A == NULL) error(1,0, "out of memory growing binary heap");
+  h->cap = cap;
+}
+
+static void *bh_create(double epsilon) {
+  binheap *h = calloc(1, sizeof(binheap));
+  if(h == NULL) error(1,0, "out of memory creating binary heap");
+  return h;
+}
+
+static void bh_destroy(void *pq) {
+  binheap *h = pq;
+  free(h->A);
+  free(h);
+}
+
+static void bh_insert(void *pq, int key) {
+  binheap *h = pq;
+  bh_reserve(h, h->n + 1);
+  min_heap_insert(h->A, h->n++, key);
+}
+
+static int bh_extract(void *pq) {
+  binheap *h = pq;
+  if(h->n == 0) error(1,0, "Tried to extract an element from an empty binary heap");
+  return min_heap_extract(h->A, h->n--);
+}
+
+/* Append the smaller array to the larger one and heapify the result. */
+static void *bh_meld(void *p, void *q) {
+  binheap *big = p, *small = q;
+  if(big->n < small->n) {
+    big = q;
+    small = p;
+  }
+
+  bh_reserve(big, big->n + small->n);
+  memcpy(big->A + big->n, small->A, small->n * sizeof(int));
+  big->n += small->n;
+  build_minheap(big->A, big->n);
+  bh_destroy(small);
+  return big;
+}
+
+static bool bh_empty(void *pq) {
+  return ((binheap *)pq)->n == 0;
+}
+
+const pq_engine binheap_engine = {
+  "binheap", false, bh_create, bh_destroy, bh_insert, bh_extract, bh_meld, bh_empty
+};
+
+/******************************************** REGISTRY ****************************************/
+
+const pq_engine *const all_engines[] = { &softheap_engine, &binheap_engine };
+const int num_engines = sizeof(all_engines) / sizeof(all_engines[0]);
+
+const pq_engine *engine_find(const char *name) {
+  for(int i = 0; i < num_engines; i++)
+    if(strcmp(all_engines[i]->name, name) == 0) return all_engines[i];
+  return NULL;
+}
@@ -0,0 +1,44 @@
+/* File: engine.h
+ * --------------
+ * A common interface over the priority queues we benchmark, so that the
+ * workload drivers (trace replay, mixed workloads, memory and scaling
+ * studies) can run the same operation sequence against each of them. An
+ * engine is a table of function pointers over an opaque queue handle.
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+  const char *name;
+  bool uses_epsilon;                  // whether create's epsilon matters
+  void *(*create)(double epsilon);
+  void (*destroy)(void *pq);
+  void (*insert)(void *pq, int key);
+  int (*extract)(void *pq);           // queue must be nonempty
+  void *(*meld)(void *p, void *q);    // destroys both arguments, returns the union
+  bool (*empty)(void *pq);
+} pq_engine;
+
+/* Kaplan-Zwick soft heap from softheap.c. */
+extern const pq_engine softheap_engine;
+
+/* Growable array-based binary min-heap built on binheap.c. Meld
+ * concatenates the arrays and rebuilds the heap in linear time. */
+extern const pq_engine binheap_engine;
+
+/* All engines, in the order drivers run them, and their number. */
+extern const pq_engine *const all_engines[];
+extern const int num_engines;
+
+/**
+ * Function: engine_find
+ * ---------------------
+ * Returns the engine with the given name, or NULL.
+ */
+const pq_engine *engine_find(const char *name);
+
+#endif // ENGINE_H
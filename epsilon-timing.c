@@ -1,116 +1,407 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <error.h>
 
 #include <softheap.h>
+#include <bench.h>
+#include <workload.h>
+#include <hist.h>
+#include <engine.h>
+#include <sweep.h>
 
+/* State shared with the benchmark harness for one (n, epsilon) configuration. */
+typedef struct {
+  int n;
+  double epsilon;
+  int steps;        // repair steps per operation for a bounded heap, or 0
+  softheap_free_mode free_mode;
+  bool runs;        // turn on the presorted-run fast path
+  workload_spec spec;
+  uint64_t seed;
+  rng g;
+  int *elts1;
+  softheap *P;
+  bool latency;     // also capture per-operation latency histograms
+  histogram *hist;  // where the latency-capturing run bodies record
+} eps_bench;
 
-void time_insert_extract(int tries, int n) {
-  int elts[n];
+/* Fill elts with n fresh keys from the configured distribution. */
+static void fill_keys(eps_bench *b, int *elts) {
+  workload_fill(elts, b->n, &b->spec, &b->g);
+}
 
-  int max_r = ceil(-log(1./n)/log(2))+5;
-  double cumul_insert[max_r+1];
-  double cumul_extract[max_r+1];
-  for(int i = 0; i < max_r+1; i++)
-    cumul_insert[i] = cumul_extract[i] = 0;
+/* Insert every key of elts into P. */
+static void insert_all(softheap *P, int *elts, int n) {
+  for(int j = 0; j < n; j++)
+    insert(P, elts[j]);
+}
 
-  printf("--------------- Insert-Extract: %d ---------------\n", n);
+static void insert_setup(void *ctx) {
+  eps_bench *b = ctx;
+  fill_keys(b, b->elts1);
+  b->P = (b->steps > 0 ? makeheap_bounded(b->epsilon, b->steps) : makeheap_empty(b->epsilon));
+  softheap_set_free_mode(b->P, b->free_mode);
+  if(b->runs) softheap_detect_runs(b->P, true);
+}
 
-  for(int i = 0; i < tries; i++) {
+static void insert_run(void *ctx) {
+  eps_bench *b = ctx;
+  insert_all(b->P, b->elts1, b->n);
+}
 
-    for(int j = 0; j < n; j++)
-      elts[j] = rand();
+static void extract_setup(void *ctx) {
+  eps_bench *b = ctx;
+  insert_setup(ctx);
+  insert_all(b->P, b->elts1, b->n);
+}
 
-    // go over all relevant values of r(epsilon)
-    for(int k = 1; k < n; k *= 2) {
-      double epsilon = ((double)k)/n;
-      int r = ceil(-log(epsilon)/log(2)) + 5;
+static void extract_run(void *ctx) {
+  eps_bench *b = ctx;
+  for(int j = 0; j < b->n; j++)
+    extract_min(b->P);
+}
 
-      softheap *P = makeheap_empty(epsilon);
+static void heap_teardown(void *ctx) {
+  eps_bench *b = ctx;
+  destroy_heap(b->P);
+  b->P = NULL;
+}
 
-      clock_t start = clock();
-      for(int j = 0; j < n; j++) {
-        insert(P, elts[j]);
-      }
-      clock_t stop = clock();
-      double insert_secs = (double)(stop-start) / CLOCKS_PER_SEC;
+/* Latency-capturing variants of the run bodies above. Every operation is
+ * timed on its own, which exposes the occasional expensive combine cascade
+ * or deep sift that an average over n operations hides. The clock reads add
+ * a few tens of ns to each sample, so these runs are kept separate from the
+ * throughput measurements. */
+static void insert_latency_run(void *ctx) {
+  eps_bench *b = ctx;
+  for(int j = 0; j < b->n; j++) {
+    uint64_t t0 = bench_now_ns();
+    insert(b->P, b->elts1[j]);
+    hist_record(b->hist, bench_now_ns() - t0);
+  }
+}
 
-      start = clock();
-      for(int j = 0; j < n; j++) {
-        extract_min(P);
-      }
-      stop = clock();
-      double extract_secs = (double)(stop-start) / CLOCKS_PER_SEC;
+static void extract_latency_run(void *ctx) {
+  eps_bench *b = ctx;
+  for(int j = 0; j < b->n; j++) {
+    uint64_t t0 = bench_now_ns();
+    extract_min(b->P);
+    hist_record(b->hist, bench_now_ns() - t0);
+  }
+}
 
-      destroy_heap(P);
+/* If latency capture is on, run the benchmark cfg->min_reps more times with
+ * the latency-capturing body and attach p50/p99/p99.9/max to res. */
+static void measure_latency(const bench_config *cfg, const bench_ops *ops, bench_fn latency_run,
+                            eps_bench *b, bench_result *res) {
+  if(!b->latency) return;
 
-      cumul_insert[r] += insert_secs;
-      cumul_extract[r] += extract_secs;
-    }
+  histogram h;
+  hist_init(&h);
+  b->hist = &h;
+  for(int i = 0; i < cfg->min_reps; i++) {
+    ops->setup(b);
+    latency_run(b);
+    ops->teardown(b);
   }
+  b->hist = NULL;
+  hist_add_metrics(&h, "lat_", res);
+}
+
+/* If the library was built with operation counters, run the benchmark once
+ * more with the counters reset just before the timed body and attach the
+ * work done per operation to res. For insert, these are the numbers to hold
+ * up against the amortized O(log 1/epsilon) bound, which is attached as well. */
+static void measure_counters(const bench_ops *ops, eps_bench *b, long nops, bench_result *res) {
+  if(!softheap_stats_enabled()) return;
+
+  softheap_stats st;
+  ops->setup(b);
+  softheap_reset_stats();
+  ops->run(b);
+  softheap_get_stats(&st);
+  ops->teardown(b);
+
+  bench_add_metric(res, "log2(1/eps)", -log(b->epsilon)/log(2));
+  bench_add_metric(res, "sift/op", (double)st.sift_calls / nops);
+  bench_add_metric(res, "sift_iter/op", (double)st.sift_iterations / nops);
+  bench_add_metric(res, "movelist/op", (double)st.movelist_calls / nops);
+  bench_add_metric(res, "combine/op", (double)st.combine_calls / nops);
+  bench_add_metric(res, "sufmin/op", (double)st.sufmin_steps / nops);
+  bench_add_metric(res, "trees_new/op", (double)st.trees_created / nops);
+  bench_add_metric(res, "trees_del/op", (double)st.trees_destroyed / nops);
+  bench_add_metric(res, "alloc/op", (double)st.allocs / nops);
+  bench_add_metric(res, "free/op", (double)st.frees / nops);
+}
+
+static const char *const free_mode_names[] = { "now", "deferred", "background" };
+
+/* Format the key distribution, epsilon/r(epsilon) and, where they are not
+ * the defaults, the steps per operation, free mode and run detection into a
+ * result label. */
+static char *eps_label(char *buf, size_t len, const eps_bench *b) {
+  char dist[64];
+  int r = ceil(-log(b->epsilon)/log(2)) + 5;
+  size_t used = snprintf(buf, len, "%s;eps=%.3g;r=%d", workload_describe(&b->spec, dist, sizeof(dist)),
+                         b->epsilon, r);
+  if(b->steps > 0 && used < len) used += snprintf(buf + used, len - used, ";steps=%d", b->steps);
+  if(b->free_mode != SOFTHEAP_FREE_NOW && used < len)
+    used += snprintf(buf + used, len - used, ";free=%s", free_mode_names[b->free_mode]);
+  if(b->runs && used < len) snprintf(buf + used, len - used, ";runs=on");
+  return buf;
+}
+
+/* One configuration of the insert/extract sweep, with private keys and
+ * heaps so that configurations can run on separate threads. */
+typedef struct {
+  eps_bench b;
+  char label[96];
+  bench_result insert, extract;
+} eps_config;
+
+typedef struct {
+  const bench_config *cfg;
+  eps_config *configs;
+} eps_sweep;
+
+/* Sweep worker: time insert and extract at configuration i's epsilon. */
+static void insert_extract_work(int i, void *ctx) {
+  eps_sweep *sw = ctx;
+  eps_config *c = &sw->configs[i];
+  eps_bench *b = &c->b;
+  int n = b->n;
+  rng_seed(&b->g, b->seed); // a private, reproducible key stream per epsilon
+  b->elts1 = malloc(n * sizeof(int));
+  if(b->elts1 == NULL) error(1,0, "out of memory allocating keys");
+  eps_label(c->label, sizeof(c->label), b);
+
+  bench_ops insert_ops = { insert_setup, insert_run, heap_teardown };
+  bench_ops extract_ops = { extract_setup, extract_run, heap_teardown };
+
+  bench_run(sw->cfg, &insert_ops, b, n, &c->insert);
+  measure_latency(sw->cfg, &insert_ops, insert_latency_run, b, &c->insert);
+  measure_counters(&insert_ops, b, n, &c->insert);
+
+  bench_run(sw->cfg, &extract_ops, b, n, &c->extract);
+  measure_latency(sw->cfg, &extract_ops, extract_latency_run, b, &c->extract);
+  measure_counters(&extract_ops, b, n, &c->extract);
+
+  free(b->elts1);
+  b->elts1 = NULL;
+}
+
+/* Sweep emitter: report configuration i, in order. */
+static void insert_extract_emit(int i, void *ctx) {
+  eps_sweep *sw = ctx;
+  eps_config *c = &sw->configs[i];
+  bench_report(sw->cfg, "epsilon-timing", "insert", c->label, c->b.n, &c->insert);
+  bench_report(sw->cfg, "epsilon-timing", "extract", c->label, c->b.n, &c->extract);
+}
+
+/* Time insert and extract over all relevant values of r(epsilon), running
+ * up to nthreads configurations at once. If b asks for a bounded heap, each
+ * epsilon is timed on the ordinary heap and then on the bounded one, with
+ * the same keys, so that their latencies can be compared row by row. */
+void time_insert_extract(const bench_config *cfg, eps_bench b, int nthreads) {
+  int n = b.n, count = 0, variants = (b.steps > 0 ? 2 : 1);
+  for(int k = 1; k < n; k *= 2) count += variants;
 
-  for(int i = max_r; i > 5; i--) {
-    printf("r=%d \t average insert: %f \t average extract: %f\n", i, cumul_insert[i]/tries, cumul_extract[i]/tries);
+  eps_sweep sw = { cfg, malloc(count * sizeof(eps_config)) };
+  if(sw.configs == NULL) error(1,0, "out of memory allocating sweep");
+  for(int i = 0, k = 1; i < count; i++) {
+    sw.configs[i].b = b;
+    sw.configs[i].b.epsilon = ((double)k)/n;
+    sw.configs[i].b.seed = b.seed + i / variants;
+    if(variants == 2 && i % 2 == 0) sw.configs[i].b.steps = 0;
+    if(i % variants == variants - 1) k *= 2;
   }
+
+  sweep_run(count, nthreads, insert_extract_work, insert_extract_emit, &sw);
+  free(sw.configs);
 }
 
-void time_meld(int tries, int n) {
-  int elts1[n];
-  int elts2[n];
+/******************************************** MELD ****************************************/
 
-  int max_r = ceil(-log(1./n)/log(2))+5;
-  double cumul[max_r+1];
-  for(int i = 0; i < max_r+1; i++)
-    cumul[i] = 0;
+/* The meld scenarios. RATIO melds a heap of n keys with one of n/ratio keys
+ * (one meld per repetition). CHAIN melds n/part heaps of part keys each, one
+ * after another, into an initially empty heap. CYCLE repeatedly melds a heap
+ * of part keys into a heap of n keys and extracts part keys again, so the
+ * big heap stays at steady state. */
+typedef enum { MELD_RATIO, MELD_CHAIN, MELD_CYCLE } meld_kind;
 
-  printf("--------------- Meld: %d (%d tries) ----------\n", n, tries);
+typedef struct {
+  const char *name;
+  meld_kind kind;
+  int param;        // size ratio for RATIO, keys per small heap otherwise
+} meld_scenario;
 
-  for(int i = 0; i < tries; i++) {
+static const meld_scenario meld_scenarios[] = {
+  { "meld-1:1", MELD_RATIO, 1 },
+  { "meld-1:100", MELD_RATIO, 100 },
+  { "meld-1:10000", MELD_RATIO, 10000 },
+  { "meld-chain-1", MELD_CHAIN, 1 },
+  { "meld-chain-16", MELD_CHAIN, 16 },
+  { "meld-extract-16", MELD_CYCLE, 16 },
+};
 
-    for(int j = 0; j < n; j++) {
-      elts1[j] = rand();
-      elts2[i] = rand();
-    }
+/* State of one meld benchmark. The eps_bench comes first so that a pointer
+ * to it is a pointer to the whole, and measure_latency/measure_counters can
+ * be used unchanged. Melds go through the engine interface so that the soft
+ * heap and the binary heap are measured on exactly the same keys. */
+typedef struct {
+  eps_bench b;
+  const meld_scenario *sc;
+  const pq_engine *e;
+  int *keys;        // 2n keys, drawn fresh in every setup
+  void *P;          // the heap everything is melded into
+  void **parts;     // the small heaps, consumed by the run
+  int nparts;
+} meld_bench;
 
-    // go over all relevant values of r(epsilon)
-    for(int k = 1; k < n; k *= 2) {
-      double epsilon = ((double)k)/n;
-      int r = ceil(-log(epsilon)/log(2)) + 5;
+/* Number of keys in each small heap. */
+static int part_size(const meld_bench *m) {
+  if(m->sc->kind != MELD_RATIO) return m->sc->param;
+  int size = m->b.n / m->sc->param;
+  return size > 0 ? size : 1;
+}
 
-      softheap *P = makeheap_empty(epsilon);
-      softheap *Q = makeheap_empty(epsilon);
+/* Build a heap from keys[0..n-1] with the current engine. */
+static void *build_heap(const meld_bench *m, const int *keys, int n) {
+  void *pq = m->e->create(m->b.epsilon);
+  for(int j = 0; j < n; j++) m->e->insert(pq, keys[j]);
+  return pq;
+}
 
-      for(int j = 0; j < n; j++) {
-        insert(P, elts1[j]);
-        insert(Q, elts2[j]);
-      }
+static void meld_setup(void *ctx) {
+  meld_bench *m = ctx;
+  int n = m->b.n, size = part_size(m);
+  workload_fill(m->keys, 2 * n, &m->b.spec, &m->b.g);
+
+  m->P = (m->sc->kind == MELD_CHAIN ? m->e->create(m->b.epsilon) : build_heap(m, m->keys, n));
+  const int *rest = (m->sc->kind == MELD_CHAIN ? m->keys : m->keys + n);
+  m->nparts = (m->sc->kind == MELD_RATIO ? 1 : n / size);
+  for(int i = 0; i < m->nparts; i++) m->parts[i] = build_heap(m, rest + i * size, size);
+}
 
-      clock_t start = clock();
-      P = meld(P, Q);
-      clock_t stop = clock();
-      double meld_secs = (double)(stop-start) / CLOCKS_PER_SEC;
+/* Perform the scenario's melds (and extracts), timing each meld into
+ * m->b.hist if timed is set. Both uses below pass a constant, so the
+ * throughput body carries no clock reads. */
+static inline void do_melds(meld_bench *m, bool timed) {
+  const pq_engine *e = m->e;
+  int size = part_size(m);
 
-      cumul[r] += meld_secs;
+  for(int i = 0; i < m->nparts; i++) {
+    uint64_t t0 = (timed ? bench_now_ns() : 0);
+    m->P = e->meld(m->P, m->parts[i]);
+    if(timed) hist_record(m->b.hist, bench_now_ns() - t0);
+    m->parts[i] = NULL;
 
-      destroy_heap(P);
-    }
+    if(m->sc->kind == MELD_CYCLE)
+      for(int j = 0; j < size; j++) e->extract(m->P);
   }
+}
+
+static void meld_run(void *ctx) {
+  do_melds(ctx, false);
+}
 
-  for(int i = max_r; i > 5; i--) {
-    printf("r=%d \t average meld: %f \n", i, cumul[i]/tries);
+static void meld_latency_run(void *ctx) {
+  do_melds(ctx, true);
+}
+
+static void meld_teardown(void *ctx) {
+  meld_bench *m = ctx;
+  m->e->destroy(m->P);
+  m->P = NULL;
+}
+
+/* Run every meld scenario against every engine. The soft heap is measured
+ * at an exact epsilon (1/n) and a few lossy ones; results are reported per
+ * meld, or per meld-and-extract round for the cycle scenario. */
+void time_meld(const bench_config *cfg, eps_bench b) {
+  int n = b.n;
+  meld_bench m = { b };
+  m.keys = malloc(2 * n * sizeof(int));
+  m.parts = malloc(n * sizeof(void *));
+  if(m.keys == NULL || m.parts == NULL) error(1,0, "out of memory allocating keys");
+
+  double epsilons[] = { 1.0 / n, 0.01, 0.1, 0.5 };
+  int neps = sizeof(epsilons) / sizeof(epsilons[0]);
+  bench_ops meld_ops = { meld_setup, meld_run, meld_teardown };
+
+  for(size_t s = 0; s < sizeof(meld_scenarios) / sizeof(meld_scenarios[0]); s++) {
+    m.sc = &meld_scenarios[s];
+    long nops = (m.sc->kind == MELD_RATIO ? 1 : n / part_size(&m));
+
+    for(int i = 0; i < num_engines; i++) {
+      m.e = all_engines[i];
+      for(int k = 0; k < (m.e->uses_epsilon ? neps : 1); k++) {
+        m.b.epsilon = epsilons[k];
+        char label[64], param[96], dist[64];
+        if(m.e->uses_epsilon) snprintf(param, sizeof(param), "%s;%s", m.e->name, eps_label(label, sizeof(label), &m.b));
+        else snprintf(param, sizeof(param), "%s;%s", m.e->name, workload_describe(&b.spec, dist, sizeof(dist)));
+
+        bench_result res;
+        bench_run(cfg, &meld_ops, &m, nops, &res);
+        measure_latency(cfg, &meld_ops, meld_latency_run, &m.b, &res);
+        if(m.e->uses_epsilon) measure_counters(&meld_ops, &m.b, nops, &res);
+        bench_report(cfg, "epsilon-timing", m.sc->name, param, n, &res);
+      }
+    }
   }
 
+  free(m.keys);
+  free(m.parts);
+}
+
+/* Command-line settings: the benchmark template and the sweep's pool size. */
+typedef struct {
+  eps_bench b;
+  int threads;
+} eps_options;
+
+/* Handle the driver-specific -n (heap size), -d (key distribution), -s (seed),
+ * -l (per-operation latency histograms), -k (also time bounded heaps with
+ * this many steps per operation), -F (free mode for the insert/extract
+ * heaps: now, deferred or background), -P (presorted-run fast path) and
+ * -j (sweep threads) options. */
+static void parse_extra(int opt, const char *arg, void *ctx) {
+  eps_options *o = ctx;
+  eps_bench *b = &o->b;
+  if(opt == 'n') b->n = atoi(arg);
+  if(opt == 'l') b->latency = true;
+  if(opt == 'k') b->steps = atoi(arg);
+  if(opt == 'P') b->runs = true;
+  if(opt == 'F') {
+    int m = 0;
+    while(m < 3 && strcmp(arg, free_mode_names[m]) != 0) m++;
+    if(m == 3) error(1,0, "unknown free mode '%s' (now, deferred or background)", arg);
+    b->free_mode = m;
+  }
+  if(opt == 'd' && !workload_parse(arg, &b->spec)) error(1,0, "unknown key distribution '%s'", arg);
+  if(opt == 's') b->seed = strtoull(arg, NULL, 10);
+  if(opt == 'j') o->threads = atoi(arg);
 }
 
 int main(int argc, char *argv[]) {
-  int n = 10000;
-  int tries = 10;
+  eps_options o = { { .n = 10000, .spec = { DIST_UNIFORM, 0, 0 }, .seed = time(NULL) }, 1 };
 
-  srand(time(NULL));
+  bench_config cfg;
+  bench_default_config(&cfg);
+  cfg.min_reps = 10;
+  bench_parse_options(&cfg, argc, argv, "n:d:s:lk:F:Pj:", parse_extra, &o);
+  if(o.b.n <= 1) error(1,0, "n must be at least 2");
+  if(o.threads <= 0) o.threads = sweep_default_threads();
+  rng_seed(&o.b.g, o.b.seed);
 
-  time_insert_extract(tries, n);
-  time_meld(tries, n);
+  // Concurrent configurations share caches and memory bandwidth, so the
+  // sweep is serial unless -j asks otherwise (-j 0 for one per CPU)
+  bench_report_begin(&cfg);
+  time_insert_extract(&cfg, o.b, o.threads);
+  time_meld(&cfg, o.b);
 
   return 0;
 }
@@ -0,0 +1,172 @@
+/* File: heap-shape.c
+ * ------------------
+ * Prints the structure of soft heaps (see softheap_get_shape) at regular
+ * checkpoints while they are being used, to help tune epsilon. A soft heap
+ * observer counts client operations and, every -c of them, dumps the shape
+ * of the heap the operation touched. The workload is either synthetic
+ * (insert n keys, then extract a fraction of them) or a trace recorded from
+ * any benchmark with trace_start_recording (see trace.h), replayed here.
+ *
+ *   ./heap-shape [-n keys] [-E eps] [-d dist] [-x extract-fraction] [-c every] [-s seed]
+ *   ./heap-shape [-E eps] [-c every] -t trace-file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <error.h>
+
+#include "softheap.h"
+#include "trace.h"
+#include "workload.h"
+
+static const char *const op_names[] = { "create", "insert", "extract", "meld", "destroy" };
+
+/* Command-line settings and checkpoint state. */
+typedef struct {
+  long n;
+  double epsilon;            // for the synthetic workload, or to override the trace's
+  workload_spec spec;
+  double extract_fraction;
+  long every;
+  uint64_t seed;
+  const char *trace_path;
+
+  long nops;                 // operations observed so far
+  int checkpoint;
+} shape_options;
+
+/* Print the nonzero entries of a per-rank array on one line. */
+static void print_by_rank(const char *label, const long *counts, int maxrank) {
+  printf("  %-16s", label);
+  for(int k = 0; k <= maxrank; k++)
+    if(counts[k] != 0) printf(" %d:%ld", k, counts[k]);
+  printf("\n");
+}
+
+/* Print one checkpoint's worth of shape statistics. */
+static void print_shape(const shape_options *o, const softheap_event *ev, const softheap_shape *sh) {
+  static const char *const buckets[SOFTHEAP_LIST_BUCKETS] = {
+    "empty", "<1/2", "<1", "<3/2", "<2", "<3", "<4", ">=4"
+  };
+
+  printf("checkpoint %d after op %ld (%s): eps=%g r=%d rank=%d items=%ld trees=%ld nodes=%ld "
+         "leaves=%ld\n", o->checkpoint, o->nops, op_names[ev->op], sh->epsilon, sh->r, sh->rank,
+         sh->nitems, sh->ntrees, sh->nnodes, sh->nleaves);
+  printf("  corrupted=%ld (%.4f of items) max_inflation=%ld deficient_leaves=%ld "
+         "deficient_internal=%ld\n", sh->corrupted, sh->nitems ? (double)sh->corrupted / sh->nitems : 0,
+         sh->max_inflation, sh->deficient_leaves, sh->deficient_internal);
+
+  int maxrank = 0;
+  for(int k = 0; k < SOFTHEAP_MAX_RANK; k++)
+    if(sh->nodes_by_rank[k] != 0 || sh->trees_by_rank[k] != 0) maxrank = k;
+  print_by_rank("roots by rank:", sh->trees_by_rank, maxrank);
+
+  printf("  %4s %10s %6s %10s %13s\n", "rank", "nodes", "size", "mean list", "max inflation");
+  for(int k = 0; k <= maxrank; k++) {
+    if(sh->nodes_by_rank[k] == 0) continue;
+    printf("  %4d %10ld %6d %10.2f %13ld\n", k, sh->nodes_by_rank[k], sh->size_by_rank[k],
+           (double)sh->items_by_rank[k] / sh->nodes_by_rank[k], sh->inflation_by_rank[k]);
+  }
+
+  printf("  list/size:      ");
+  for(int b = 0; b < SOFTHEAP_LIST_BUCKETS; b++) printf(" %s:%ld", buckets[b], sh->list_vs_size[b]);
+  printf("\n\n");
+}
+
+/* Observer: every o->every operations, dump the shape of the heap the
+ * operation left behind. Destroys are reported before the heap goes away,
+ * so they never trigger a checkpoint. */
+static void checkpoint_observer(const softheap_event *ev, void *ctx) {
+  shape_options *o = ctx;
+  o->nops++;
+  if(ev->op == SH_OP_DESTROY || o->nops % o->every != 0) return;
+
+  softheap_shape sh;
+  softheap_get_shape(ev->result, &sh);
+  o->checkpoint++;
+  print_shape(o, ev, &sh);
+}
+
+/* Insert n keys into a fresh heap, then extract a fraction of them. */
+static void run_synthetic(shape_options *o) {
+  int *keys = malloc(o->n * sizeof(int));
+  if(keys == NULL) error(1,0, "out of memory allocating keys");
+  rng g;
+  rng_seed(&g, o->seed);
+  workload_fill(keys, o->n, &o->spec, &g);
+
+  softheap *P = makeheap_empty(o->epsilon);
+  for(long i = 0; i < o->n; i++) insert(P, keys[i]);
+  for(long i = 0; i < o->n * o->extract_fraction && !empty(P); i++) extract_min(P);
+  destroy_heap(P);
+  free(keys);
+}
+
+/* Replay a recorded trace against soft heaps. */
+static void run_trace(shape_options *o) {
+  trace t;
+  if(!trace_load(o->trace_path, &t)) error(1,0, "cannot load trace %s", o->trace_path);
+  softheap **heaps = calloc(t.nheaps > 0 ? t.nheaps : 1, sizeof(softheap *));
+  if(heaps == NULL) error(1,0, "out of memory allocating heap table");
+
+  for(size_t i = 0; i < t.nrecords; i++) {
+    const trace_record *r = &t.records[i];
+    switch(r->op) {
+    case TRACE_CREATE:
+      heaps[r->heap] = makeheap_empty(o->epsilon > 0 ? o->epsilon : trace_epsilon(r));
+      break;
+    case TRACE_INSERT: insert(heaps[r->heap], r->arg); break;
+    case TRACE_EXTRACT: extract_min(heaps[r->heap]); break;
+    case TRACE_MELD:
+      heaps[r->heap] = meld(heaps[r->heap], heaps[r->arg]);
+      heaps[r->arg] = NULL;
+      break;
+    case TRACE_DESTROY:
+      destroy_heap(heaps[r->heap]);
+      heaps[r->heap] = NULL;
+      break;
+    default:
+      error(1,0, "record %zu: unknown trace operation %d", i, r->op);
+    }
+  }
+
+  for(int i = 0; i < t.nheaps; i++) destroy_heap(heaps[i]);
+  free(heaps);
+  trace_free(&t);
+}
+
+int main(int argc, char *argv[]) {
+  shape_options o = { 100000, 0, { DIST_UNIFORM, 0, 0 }, 0.5, 0, time(NULL), NULL };
+  int opt;
+  while((opt = getopt(argc, argv, "n:E:d:x:c:s:t:")) != -1) {
+    switch(opt) {
+    case 'n': o.n = atof(optarg); break;
+    case 'E': o.epsilon = atof(optarg); break;
+    case 'x': o.extract_fraction = atof(optarg); break;
+    case 'c': o.every = atol(optarg); break;
+    case 's': o.seed = strtoull(optarg, NULL, 10); break;
+    case 't': o.trace_path = optarg; break;
+    case 'd':
+      if(!workload_parse(optarg, &o.spec)) error(1,0, "unknown key distribution '%s'", optarg);
+      break;
+    default:
+      error(1,0, "usage: ./heap-shape [-n keys] [-E eps] [-d dist] [-x extract-fraction] [-c every] [-s seed]\n"
+                 "       ./heap-shape [-E eps] [-c every] -t trace-file");
+    }
+  }
+  if(o.trace_path == NULL && o.n < 1) error(1,0, "need at least one key");
+  if(o.every <= 0) o.every = (o.trace_path == NULL ? o.n / 4 : 100000); // a handful of checkpoints
+  if(o.every <= 0) o.every = 1;
+
+  softheap_set_observer(checkpoint_observer, &o);
+  if(o.trace_path != NULL) run_trace(&o);
+  else {
+    if(o.epsilon <= 0) o.epsilon = 0.01;
+    run_synthetic(&o);
+  }
+  softheap_set_observer(NULL, NULL);
+  return 0;
+}
@@ -0,0 +1,96 @@
+/* File: hist.c
+ * ------------
+ * Implementation of log-linear latency histograms. See hist.h.
+ */
+
+#include "hist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+void hist_init(histogram *h) {
+  memset(h, 0, sizeof(*h));
+  h->min = UINT64_MAX;
+}
+
+void hist_merge(histogram *into, const histogram *from) {
+  for(int i = 0; i < HIST_NBUCKETS; i++) into->buckets[i] += from->buckets[i];
+  into->count += from->count;
+  into->sum += from->sum;
+  if(from->min < into->min) into->min = from->min;
+  if(from->max > into->max) into->max = from->max;
+}
+
+/* Largest value that falls into bucket idx. */
+static uint64_t bucket_high(int idx) {
+  if(idx < 2 * HIST_SUB_COUNT) return idx;
+  int shift = idx / HIST_SUB_COUNT - 1;
+  uint64_t sub = (idx % HIST_SUB_COUNT) + HIST_SUB_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+uint64_t hist_percentile(const histogram *h, double p) {
+  if(h->count == 0) return 0;
+  uint64_t rank = (uint64_t)ceil(p / 100 * h->count);
+  if(rank < 1) rank = 1;
+
+  uint64_t seen = 0;
+  for(int i = 0; i < HIST_NBUCKETS; i++) {
+    seen += h->buckets[i];
+    if(seen >= rank) {
+      uint64_t v = bucket_high(i);
+      return (v > h->max ? h->max : v);
+    }
+  }
+  return h->max;
+}
+
+double hist_mean(const histogram *h) {
+  return (h->count > 0 ? h->sum / h->count : 0);
+}
+
+/* Metric keys are built once per prefix and kept for the life of the
+ * program, since bench_result only stores pointers to them. Drivers only ever
+ * use a handful of prefixes, so a small linear table is plenty. The table
+ * is locked because sweep workers (sweep.h) attach metrics concurrently. */
+#define MAX_PREFIXES 32
+#define NPCTS 4
+
+static const struct { const char *suffix; double p; } pcts[NPCTS] = {
+  { "p50_ns", 50 }, { "p99_ns", 99 }, { "p99.9_ns", 99.9 }, { "max_ns", 100 }
+};
+
+static const char **metric_keys(const char *prefix) {
+  static struct { char *prefix; const char *keys[NPCTS]; } table[MAX_PREFIXES];
+  static int nprefixes = 0;
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+  pthread_mutex_lock(&lock);
+  for(int i = 0; i < nprefixes; i++) {
+    if(strcmp(table[i].prefix, prefix) == 0) {
+      pthread_mutex_unlock(&lock);
+      return table[i].keys;
+    }
+  }
+
+  if(nprefixes == MAX_PREFIXES) abort();
+  table[nprefixes].prefix = strdup(prefix);
+  for(int j = 0; j < NPCTS; j++) {
+    size_t len = strlen(prefix) + strlen(pcts[j].suffix) + 1;
+    char *key = malloc(len);
+    if(key == NULL) abort();
+    snprintf(key, len, "%s%s", prefix, pcts[j].suffix);
+    table[nprefixes].keys[j] = key;
+  }
+  const char **keys = table[nprefixes++].keys;
+  pthread_mutex_unlock(&lock);
+  return keys;
+}
+
+void hist_add_metrics(const histogram *h, const char *prefix, bench_result *res) {
+  const char **keys = metric_keys(prefix);
+  for(int i = 0; i < NPCTS; i++) bench_add_metric(res, keys[i], hist_percentile(h, pcts[i].p));
+}
@@ -0,0 +1,87 @@
+/* File: hist.h
+ * ------------
+ * Log-linear (HDR-style) latency histograms. Values below 2^(HIST_SUB_BITS+1)
+ * are counted exactly; above that, each power-of-two range is split into
+ * 2^HIST_SUB_BITS equal sub-buckets, so any recorded value is reported with a
+ * relative error of at most 2^-HIST_SUB_BITS (about 3%). The histogram is a
+ * fixed-size array, so recording is a handful of instructions and never
+ * allocates, which makes it cheap enough to call around every operation.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+#include "bench.h"
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_NBUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+  uint64_t count, min, max;
+  double sum;
+  uint64_t buckets[HIST_NBUCKETS];
+} histogram;
+
+/* Index of the bucket counting value v. */
+static inline int hist_bucket(uint64_t v) {
+  if(v < 2 * HIST_SUB_COUNT) return (int)v;
+  int msb = 63 - __builtin_clzll(v);
+  int shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB_COUNT + (int)((v >> shift) - HIST_SUB_COUNT);
+}
+
+/**
+ * Function: hist_record
+ * ---------------------
+ * Counts one occurrence of value v.
+ */
+static inline void hist_record(histogram *h, uint64_t v) {
+  h->buckets[hist_bucket(v)]++;
+  h->count++;
+  h->sum += v;
+  if(v < h->min) h->min = v;
+  if(v > h->max) h->max = v;
+}
+
+/**
+ * Function: hist_init
+ * -------------------
+ * Resets h to the empty histogram.
+ */
+void hist_init(histogram *h);
+
+/**
+ * Function: hist_merge
+ * --------------------
+ * Adds all the counts of from into into.
+ */
+void hist_merge(histogram *into, const histogram *from);
+
+/**
+ * Function: hist_percentile
+ * -------------------------
+ * Returns the value at percentile p (0-100): the highest value equivalent to
+ * the bucket containing the p-th percentile, clamped to the recorded max.
+ * Returns 0 for an empty histogram.
+ */
+uint64_t hist_percentile(const histogram *h, double p);
+
+/**
+ * Function: hist_mean
+ * -------------------
+ * Returns the exact mean of the recorded values.
+ */
+double hist_mean(const histogram *h);
+
+/**
+ * Function: hist_add_metrics
+ * --------------------------
+ * Attaches p50/p99/p99.9/max of h to a benchmark result, with each key
+ * prefixed by prefix (e.g. "lat_" gives "lat_p99_ns"). prefix must outlive res.
+ */
+void hist_add_metrics(const histogram *h, const char *prefix, bench_result *res);
+
+#endif // HIST_H
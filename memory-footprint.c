@@ -0,0 +1,260 @@
+/* File: memory-footprint.c
+ * ------------------------
+ * Measures how much memory a priority queue needs per element. For each
+ * size n (powers of ten between -n and -N) we build a packed int array, a
+ * binary heap, and soft heaps for a sweep of epsilons from 1/n up to 0.5,
+ * and report the growth in allocator in-use bytes (mallinfo2) and in
+ * resident set size (bench_rss) per element. Sizes whose footprint,
+ * extrapolated from the previous size, would not fit in available memory
+ * are skipped.
+ *
+ *   ./memory-footprint [harness options] [-n min] [-N max] [-E eps,eps,...]
+ *                      [-b baseline.csv] [-T tolerance] [-s seed]
+ *
+ * With -b, bytes per item are compared against a CSV written earlier by
+ * "-f csv", and any structure that grew by more than the tolerance (default
+ * 5%) is reported on stderr and makes the program exit with status 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <malloc.h>
+#include <error.h>
+
+#include "bench.h"
+#include "engine.h"
+#include "workload.h"
+
+#define MAX_EPSILONS 16
+#define MAX_BASELINE 1024
+
+/* A row of the baseline CSV that we compare against. */
+typedef struct {
+  char name[32], param[64];
+  long n;
+  double bytes_per_item;
+} baseline_row;
+
+/* Command-line settings. */
+typedef struct {
+  long min_n, max_n;
+  double eps[MAX_EPSILONS];
+  int neps;
+  const char *baseline;
+  double tolerance;
+  uint64_t seed;
+} options;
+
+/* State of one measurement. engine is NULL for the packed array. */
+typedef struct {
+  const pq_engine *engine;
+  double epsilon;
+  long n;
+  uint64_t seed;
+
+  int *array;
+  void *pq;
+  size_t heap_before, rss_before;
+  size_t heap_bytes, rss_bytes;
+} fp_state;
+
+/******************************************** MEMORY ****************************************/
+
+/* Bytes currently handed out by malloc, including chunk headers and
+ * mmapped blocks but not free memory the allocator is holding on to. */
+static size_t heap_in_use(void) {
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+/******************************************** BUILDING ****************************************/
+
+/* Untimed setup: return freed memory to the system so that the RSS
+ * baseline is not inflated by the previous measurement. */
+static void fp_setup(void *ctx) {
+  fp_state *s = ctx;
+  malloc_trim(0);
+  s->heap_before = heap_in_use();
+  s->rss_before = bench_rss();
+}
+
+/* Timed body: build the structure with n uniformly random keys. Keys are
+ * drawn on the fly so that no key buffer counts against the footprint. */
+static void fp_run(void *ctx) {
+  fp_state *s = ctx;
+  rng g;
+  rng_seed(&g, s->seed);
+
+  if(s->engine == NULL) {
+    s->array = malloc(s->n * sizeof(int));
+    if(s->array == NULL) error(1,0, "out of memory allocating %ld ints", s->n);
+    for(long i = 0; i < s->n; i++) s->array[i] = (int)rng_next(&g);
+  } else {
+    const pq_engine *e = s->engine;
+    s->pq = e->create(s->epsilon);
+    for(long i = 0; i < s->n; i++) e->insert(s->pq, (int)rng_next(&g));
+  }
+}
+
+/* Untimed teardown: record the footprint, then release the structure. */
+static void fp_teardown(void *ctx) {
+  fp_state *s = ctx;
+  size_t heap = heap_in_use(), rss = bench_rss();
+  s->heap_bytes = (heap > s->heap_before ? heap - s->heap_before : 0);
+  s->rss_bytes = (rss > s->rss_before ? rss - s->rss_before : 0);
+
+  if(s->engine == NULL) free(s->array);
+  else s->engine->destroy(s->pq);
+  s->array = NULL;
+  s->pq = NULL;
+}
+
+/******************************************** BASELINE ****************************************/
+
+static baseline_row baseline[MAX_BASELINE];
+static int nbaseline;
+
+/* Load the memory-footprint rows of a CSV written by an earlier run. */
+static void load_baseline(const char *path) {
+  FILE *f = fopen(path, "r");
+  if(f == NULL) error(1,0, "cannot open baseline %s", path);
+
+  char line[1024];
+  while(fgets(line, sizeof(line), f) != NULL && nbaseline < MAX_BASELINE) {
+    baseline_row *b = &baseline[nbaseline];
+    char *metrics = strrchr(line, ',');
+    char *bpi = (metrics != NULL ? strstr(metrics, "bytes_per_item=") : NULL);
+    if(strncmp(line, "memory,", 7) != 0 || bpi == NULL) continue;
+
+    // name and param may be empty, which sscanf's %[ cannot match
+    char *name = line + 7, *param = strchr(name, ','), *n = (param ? strchr(param + 1, ',') : NULL);
+    if(n == NULL) continue;
+    snprintf(b->name, sizeof(b->name), "%.*s", (int)(param - name), name);
+    snprintf(b->param, sizeof(b->param), "%.*s", (int)(n - param - 1), param + 1);
+    b->n = atol(n + 1);
+    b->bytes_per_item = atof(bpi + strlen("bytes_per_item="));
+    nbaseline++;
+  }
+  fclose(f);
+  if(nbaseline == 0) error(1,0, "%s has no memory-footprint rows (write it with -f csv)", path);
+}
+
+/* Compare a measurement against the baseline. Returns false on a regression. */
+static bool check_baseline(const options *o, const char *name, const char *param, long n,
+                           double bytes_per_item) {
+  for(int i = 0; i < nbaseline; i++) {
+    const baseline_row *b = &baseline[i];
+    if(b->n != n || strcmp(b->name, name) != 0 || strcmp(b->param, param) != 0) continue;
+    if(bytes_per_item <= b->bytes_per_item * (1 + o->tolerance)) return true;
+    fprintf(stderr, "REGRESSION: %s %s n=%ld: %.2f -> %.2f bytes/item (+%.1f%%)\n", name, param, n,
+            b->bytes_per_item, bytes_per_item, 100 * (bytes_per_item / b->bytes_per_item - 1));
+    return false;
+  }
+  return true;
+}
+
+/******************************************** DRIVER ****************************************/
+
+/* Measure one structure at size n and report it. Returns the footprint in
+ * bytes per item (allocator or RSS, whichever is larger). */
+static double measure(const bench_config *cfg, const options *o, fp_state *s, double array_bytes,
+                      bool *regressed) {
+  char param[64] = "";
+  const char *name = (s->engine != NULL ? s->engine->name : "array");
+  if(s->engine != NULL && s->engine->uses_epsilon) snprintf(param, sizeof(param), "eps=%.3g", s->epsilon);
+
+  bench_ops ops = { fp_setup, fp_run, fp_teardown };
+  bench_result res;
+  bench_run(cfg, &ops, s, s->n, &res);
+
+  double heap_pi = (double)s->heap_bytes / s->n, rss_pi = (double)s->rss_bytes / s->n;
+  bench_add_metric(&res, "bytes_per_item", heap_pi);
+  bench_add_metric(&res, "rss_per_item", rss_pi);
+  bench_add_metric(&res, "vs_array", array_bytes > 0 ? heap_pi * s->n / array_bytes : 1);
+  bench_report(cfg, "memory", name, param, s->n, &res);
+
+  if(nbaseline > 0 && !check_baseline(o, name, param, s->n, heap_pi)) *regressed = true;
+  return (heap_pi > rss_pi ? heap_pi : rss_pi);
+}
+
+/* Parse a comma-separated list of epsilons. */
+static void parse_epsilons(options *o, const char *arg) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", arg);
+  o->neps = 0;
+  for(char *tok = strtok(buf, ","); tok != NULL && o->neps < MAX_EPSILONS; tok = strtok(NULL, ","))
+    o->eps[o->neps++] = atof(tok);
+}
+
+/* Handle the driver-specific options. */
+static void parse_extra(int opt, const char *arg, void *ctx) {
+  options *o = ctx;
+  switch(opt) {
+  case 'n': o->min_n = atof(arg); break;
+  case 'N': o->max_n = atof(arg); break;
+  case 'E': parse_epsilons(o, arg); break;
+  case 'b': o->baseline = arg; break;
+  case 'T': o->tolerance = atof(arg); break;
+  case 's': o->seed = strtoull(arg, NULL, 10); break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  options o = { 1000, 1000000000, { 0 }, 0, NULL, 0.05, time(NULL) };
+  bench_config cfg;
+  bench_default_config(&cfg);
+  bench_parse_options(&cfg, argc, argv, "n:N:E:b:T:s:", parse_extra, &o);
+  if(o.min_n < 1 || o.max_n < o.min_n) error(1,0, "need 1 <= min n <= max n");
+  if(o.baseline != NULL) load_baseline(o.baseline);
+
+  // The footprint is deterministic, so a single build per point without
+  // warmup is enough; the reported time is just the cost of building.
+  cfg.warmup = 0;
+  cfg.min_reps = cfg.max_reps = 1;
+
+  // Footprint per item at the previous size, for extrapolation: the array,
+  // the binary heap, and the worst soft heap (epsilons shift with n). Before
+  // the first size we assume a doubled array and a generous soft heap.
+  double last_pi[3] = { 4, 8, 128 };
+  bool regressed = false;
+  fp_state s = { .seed = o.seed };
+
+  bench_report_begin(&cfg);
+  for(long n = o.min_n; n <= o.max_n; n *= 10) {
+    s.n = n;
+
+    // Sweep from an exact heap at 1/n up to 0.5 by factors of ten, unless given
+    double eps[MAX_EPSILONS];
+    int neps = 0;
+    if(o.neps > 0) {
+      memcpy(eps, o.eps, sizeof(eps));
+      neps = o.neps;
+    } else {
+      for(double e = 1.0 / n; e < 0.5 && neps < MAX_EPSILONS - 1; e *= 10) eps[neps++] = e;
+      eps[neps++] = 0.5;
+    }
+
+    double worst = 0;
+    for(int k = 0; k < neps + 2; k++) {
+      s.engine = (k == 0 ? NULL : k == 1 ? &binheap_engine : &softheap_engine);
+      s.epsilon = (k >= 2 ? eps[k - 2] : 0);
+      int slot = (k < 2 ? k : 2);
+      double guess = last_pi[slot];
+      if(guess * n > 0.9 * bench_available_memory()) {
+        fprintf(stderr, "Skipping %s at n=%ld: about %.1f GB would not fit in memory\n",
+                s.engine != NULL ? s.engine->name : "array", n, guess * n / 1e9);
+        continue;
+      }
+
+      double pi = measure(&cfg, &o, &s, 4.0 * n, &regressed);
+      if(k < 2) last_pi[k] = pi;
+      else worst = fmax(worst, pi);
+    }
+    if(worst > 0) last_pi[2] = worst;
+  }
+
+  return regressed ? 2 : 0;
+}
@@ -0,0 +1,98 @@
+/* File: perfctr.c
+ * ---------------
+ * Implementation of hardware performance counters. See perfctr.h.
+ */
+
+#define _GNU_SOURCE // for syscall
+#include "perfctr.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* perf_event_attr type/config pairs for each counter, in perf_counter order. */
+static const struct {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+  const char *metric;
+} events[PC_NCOUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles", "cycles/op" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions", "instructions/op" },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "l1d_miss", "l1d_miss/op" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc_miss", "llc_miss/op" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_miss", "branch_miss/op" },
+  { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "dtlb_miss", "dtlb_miss/op" },
+};
+
+/* glibc has no wrapper for perf_event_open. */
+static int perf_event_open(struct perf_event_attr *attr) {
+  return syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+bool perfctr_open(perfctrs *pc) {
+  bool any = false;
+  for(int i = 0; i < PC_NCOUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1; // allowed at perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    attr.inherit = 1; // also count threads started later, e.g. the parallel sorters' workers
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    pc->fd[i] = perf_event_open(&attr);
+    if(pc->fd[i] >= 0) any = true;
+  }
+  return any;
+}
+
+void perfctr_start(perfctrs *pc) {
+  for(int i = 0; i < PC_NCOUNTERS; i++) {
+    if(pc->fd[i] < 0) continue;
+    ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void perfctr_stop(perfctrs *pc, perf_sample *out) {
+  for(int i = 0; i < PC_NCOUNTERS; i++)
+    if(pc->fd[i] >= 0) ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+  for(int i = 0; i < PC_NCOUNTERS; i++) {
+    uint64_t buf[3]; // value, time enabled, time running
+    out->valid[i] = false;
+    out->value[i] = 0;
+    if(pc->fd[i] < 0 || read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf)) continue;
+    if(buf[2] == 0) continue; // never scheduled onto the PMU
+
+    // Scale up to compensate for time spent multiplexed off the PMU
+    out->value[i] = (double)buf[0] * buf[1] / buf[2];
+    out->valid[i] = true;
+  }
+}
+
+void perfctr_close(perfctrs *pc) {
+  for(int i = 0; i < PC_NCOUNTERS; i++) {
+    if(pc->fd[i] >= 0) close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+}
+
+const char *perfctr_name(perf_counter c) {
+  return (c >= 0 && c < PC_NCOUNTERS ? events[c].name : "unknown");
+}
+
+void perfctr_add_metrics(const perf_sample *s, double nops, bench_result *res) {
+  if(nops <= 0) nops = 1;
+  for(int i = 0; i < PC_NCOUNTERS; i++)
+    if(s->valid[i]) bench_add_metric(res, events[i].metric, s->value[i] / nops);
+}
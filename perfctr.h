@@ -0,0 +1,86 @@
+/* File: perfctr.h
+ * ---------------
+ * Thin wrapper around Linux perf_event_open for counting hardware events
+ * (cycles, instructions, cache/TLB misses, branch misses) in the calling
+ * thread and any threads it starts. Each counter is opened independently, so a machine or container
+ * that supports only some of them (or none, e.g. under a restrictive
+ * perf_event_paranoid or in a VM without a PMU) still gets whatever is
+ * available; unavailable counters are simply reported as missing.
+ */
+
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdbool.h>
+
+#include "bench.h"
+
+/* The hardware events we count. */
+typedef enum {
+  PC_CYCLES,
+  PC_INSTRUCTIONS,
+  PC_L1D_MISSES,
+  PC_LLC_MISSES,
+  PC_BRANCH_MISSES,
+  PC_DTLB_MISSES,
+  PC_NCOUNTERS
+} perf_counter;
+
+/* A set of open counters. fd[i] is -1 if counter i is unavailable. */
+typedef struct {
+  int fd[PC_NCOUNTERS];
+} perfctrs;
+
+/* Counter values read after a measurement, scaled up if the kernel had to
+ * multiplex the counters. valid[i] is false for unavailable counters. */
+typedef struct {
+  double value[PC_NCOUNTERS];
+  bool valid[PC_NCOUNTERS];
+} perf_sample;
+
+/**
+ * Function: perfctr_open
+ * ----------------------
+ * Opens all counters for the calling thread (user space only), leaving them
+ * disabled. Threads created after this call are counted too, once they have
+ * exited. Returns true if at least one counter could be opened.
+ */
+bool perfctr_open(perfctrs *pc);
+
+/**
+ * Function: perfctr_start
+ * -----------------------
+ * Resets and enables every open counter.
+ */
+void perfctr_start(perfctrs *pc);
+
+/**
+ * Function: perfctr_stop
+ * ----------------------
+ * Disables every open counter and reads the counts since perfctr_start into out.
+ */
+void perfctr_stop(perfctrs *pc, perf_sample *out);
+
+/**
+ * Function: perfctr_close
+ * -----------------------
+ * Closes every open counter.
+ */
+void perfctr_close(perfctrs *pc);
+
+/**
+ * Function: perfctr_name
+ * ----------------------
+ * Returns a short name for a counter ("cycles", "l1d_miss", ...).
+ */
+const char *perfctr_name(perf_counter c);
+
+/**
+ * Function: perfctr_add_metrics
+ * -----------------------------
+ * Attaches each valid counter of s, divided by nops, to a benchmark result
+ * as "<name>/op".
+ */
+void perfctr_add_metrics(const perf_sample *s, double nops, bench_result *res);
+
+#endif // PERFCTR_H
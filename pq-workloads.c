@@ -0,0 +1,327 @@
+/* File: pq-workloads.c
+ * --------------------
+ * Steady-state priority queue workloads, run against every engine and a
+ * range of epsilons under the benchmark harness:
+ *
+ *   hold    The classic hold model from discrete-event simulation: fill the
+ *           queue to size N, then repeatedly extract the minimum t and insert
+ *           t + delta, with delta drawn from an increment distribution.
+ *   updown  Repeated up/down cycles: N inserts followed by N extracts.
+ *   meld    Random interleavings of inserts, extracts and melds across H
+ *           heaps, in the spirit of test_scraps.
+ *
+ * All random choices (increments, keys, operation sequences) are drawn in
+ * the untimed setup, so every engine sees exactly the same operations.
+ *
+ *   ./pq-workloads [harness options] [-W hold|updown|meld] [-N size]
+ *                  [-m ops] [-i exp|uniform|bimodal|triangular] [-D mean]
+ *                  [-H heaps] [-d dist] [-E eps,eps,...] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include <error.h>
+
+#include "bench.h"
+#include "engine.h"
+#include "workload.h"
+
+/* Increment distributions for the hold model, all with mean 1 before scaling. */
+typedef enum { INC_EXP, INC_UNIFORM, INC_BIMODAL, INC_TRIANGULAR, INC_COUNT } inc_dist;
+static const char *const inc_names[INC_COUNT] = { "exp", "uniform", "bimodal", "triangular" };
+
+#define MAX_EPSILONS 16
+
+/* Command-line settings. */
+typedef struct {
+  const char *only;          // run just this workload, or NULL for all
+  int N;                     // steady-state queue size
+  long ops;                  // timed operations per repetition
+  inc_dist inc;
+  double mean_inc;
+  int nheaps;
+  workload_spec keys;
+  double eps[MAX_EPSILONS];
+  int neps;
+  uint64_t seed;
+} options;
+
+/* Meld-interleaving operation codes. */
+enum { OP_INSERT, OP_EXTRACT, OP_MELD };
+
+/* State of one (workload, engine, epsilon) benchmark. */
+typedef struct {
+  const options *o;
+  const pq_engine *e;
+  double epsilon;
+  rng g;
+
+  int *prefill;              // N initial keys
+  int *incs;                 // hold: one increment per operation
+  int *keys;                 // updown: N keys per cycle; meld: one key per op
+  unsigned char *opcodes;    // meld: operation per step
+  int *targets;              // meld: heap index (and a second one for melds)
+
+  void *pq;
+  void **heaps;
+  long *sizes;
+} wl_state;
+
+/******************************************** GENERATION ****************************************/
+
+/* Draw one increment with mean 1 from the configured distribution. */
+static double draw_increment(inc_dist d, rng *g) {
+  switch(d) {
+  case INC_EXP: return -log(1 - rng_double(g));
+  case INC_UNIFORM: return 2 * rng_double(g);
+  case INC_BIMODAL: return (rng_double(g) < 0.9 ? 0.1 : 9.1); // 0.9*0.1 + 0.1*9.1 = 1
+  case INC_TRIANGULAR: return 1.5 * sqrt(rng_double(g)); // mode and max 1.5, mean (0+1.5+1.5)/3
+  default: abort();
+  }
+}
+
+/******************************************** HOLD MODEL ****************************************/
+
+static void hold_setup(void *ctx) {
+  wl_state *s = ctx;
+  const options *o = s->o;
+  for(int i = 0; i < o->N; i++) s->prefill[i] = draw_increment(o->inc, &s->g) * o->mean_inc;
+  for(long i = 0; i < o->ops; i++) s->incs[i] = draw_increment(o->inc, &s->g) * o->mean_inc;
+
+  s->pq = s->e->create(s->epsilon);
+  for(int i = 0; i < o->N; i++) s->e->insert(s->pq, s->prefill[i]);
+}
+
+static void hold_run(void *ctx) {
+  wl_state *s = ctx;
+  const pq_engine *e = s->e;
+  for(long i = 0; i < s->o->ops; i++) {
+    int t = e->extract(s->pq);
+    e->insert(s->pq, t + s->incs[i]);
+  }
+}
+
+static void single_teardown(void *ctx) {
+  wl_state *s = ctx;
+  s->e->destroy(s->pq);
+  s->pq = NULL;
+}
+
+/******************************************** UP/DOWN ****************************************/
+
+static void updown_setup(void *ctx) {
+  wl_state *s = ctx;
+  long cycles = s->o->ops / (2L * s->o->N);
+  workload_fill(s->keys, (size_t)s->o->N * (cycles > 0 ? cycles : 1), &s->o->keys, &s->g);
+  s->pq = s->e->create(s->epsilon);
+}
+
+static void updown_run(void *ctx) {
+  wl_state *s = ctx;
+  const pq_engine *e = s->e;
+  int N = s->o->N;
+  long cycles = s->o->ops / (2L * N);
+  if(cycles < 1) cycles = 1;
+
+  for(long c = 0; c < cycles; c++) {
+    int *keys = s->keys + c * N;
+    for(int i = 0; i < N; i++) e->insert(s->pq, keys[i]);
+    for(int i = 0; i < N; i++) e->extract(s->pq);
+  }
+}
+
+/**************************************** MELD INTERLEAVING ***************************************/
+
+/* Pre-draw the operation sequence. Each step inserts (50%), extracts (35%)
+ * or melds two distinct heaps (15%). An extract aimed at an empty heap is
+ * turned into an insert, which we can decide here because the sizes depend
+ * only on the sequence itself. */
+static void meld_setup(void *ctx) {
+  wl_state *s = ctx;
+  const options *o = s->o;
+  int H = o->nheaps;
+  for(int h = 0; h < H; h++) s->sizes[h] = 0;
+
+  // Start every heap at N/H elements so the run begins in steady state
+  workload_fill(s->prefill, o->N, &o->keys, &s->g);
+  workload_fill(s->keys, o->ops, &o->keys, &s->g);
+  for(int h = 0; h < H; h++) {
+    s->heaps[h] = s->e->create(s->epsilon);
+    for(int i = h; i < o->N; i += H) {
+      s->e->insert(s->heaps[h], s->prefill[i]);
+      s->sizes[h]++;
+    }
+  }
+
+  long sizes[H];
+  memcpy(sizes, s->sizes, sizeof(sizes));
+  for(long i = 0; i < o->ops; i++) {
+    double u = rng_double(&s->g);
+    int a = rng_below(&s->g, H), b = rng_below(&s->g, H - 1);
+    if(b >= a) b++;
+    s->targets[2*i] = a;
+    s->targets[2*i + 1] = b;
+
+    if(u < 0.15 && H > 1) {
+      s->opcodes[i] = OP_MELD;
+      sizes[a] += sizes[b];
+      sizes[b] = 0;
+    } else if(u < 0.50 && sizes[a] > 0) {
+      s->opcodes[i] = OP_EXTRACT;
+      sizes[a]--;
+    } else {
+      s->opcodes[i] = OP_INSERT;
+      sizes[a]++;
+    }
+  }
+}
+
+static void meld_run(void *ctx) {
+  wl_state *s = ctx;
+  const pq_engine *e = s->e;
+  void **heaps = s->heaps;
+
+  for(long i = 0; i < s->o->ops; i++) {
+    int a = s->targets[2*i], b = s->targets[2*i + 1];
+    switch(s->opcodes[i]) {
+    case OP_INSERT:
+      e->insert(heaps[a], s->keys[i]);
+      break;
+    case OP_EXTRACT:
+      e->extract(heaps[a]);
+      break;
+    case OP_MELD:
+      heaps[a] = e->meld(heaps[a], heaps[b]);
+      heaps[b] = e->create(s->epsilon);
+      break;
+    }
+  }
+}
+
+static void meld_teardown(void *ctx) {
+  wl_state *s = ctx;
+  for(int h = 0; h < s->o->nheaps; h++) s->e->destroy(s->heaps[h]);
+}
+
+/******************************************** DRIVER ****************************************/
+
+typedef struct {
+  const char *name;
+  bench_ops ops;
+} workload;
+
+static const workload workloads[] = {
+  { "hold", { hold_setup, hold_run, single_teardown } },
+  { "updown", { updown_setup, updown_run, single_teardown } },
+  { "meld", { meld_setup, meld_run, meld_teardown } },
+};
+
+/* Run one workload against every engine (and, for engines that use it,
+ * every epsilon), reporting ns/op. */
+static void run_workload(const bench_config *cfg, const options *o, const workload *w, wl_state *s) {
+  char dist[64], param[128];
+  if(strcmp(w->name, "hold") == 0)
+    snprintf(dist, sizeof(dist), "inc=%s:%g", inc_names[o->inc], o->mean_inc);
+  else if(strcmp(w->name, "meld") == 0)
+    snprintf(dist, sizeof(dist), "H=%d;%s", o->nheaps, workload_describe(&o->keys, param, sizeof(param)));
+  else
+    workload_describe(&o->keys, dist, sizeof(dist));
+
+  for(int i = 0; i < num_engines; i++) {
+    s->e = all_engines[i];
+    int neps = (s->e->uses_epsilon ? o->neps : 1);
+    for(int k = 0; k < neps; k++) {
+      s->epsilon = o->eps[k];
+      rng_seed(&s->g, o->seed); // identical operations for every engine and epsilon
+      if(s->e->uses_epsilon) snprintf(param, sizeof(param), "%s;eps=%.3g", dist, s->epsilon);
+      else snprintf(param, sizeof(param), "%s", dist);
+
+      bench_result res;
+      bench_run(cfg, &w->ops, s, o->ops, &res);
+      bench_report(cfg, w->name, s->e->name, param, o->N, &res);
+    }
+  }
+}
+
+/* Parse a comma-separated list of epsilons. */
+static void parse_epsilons(options *o, const char *arg) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", arg);
+  o->neps = 0;
+  for(char *tok = strtok(buf, ","); tok != NULL && o->neps < MAX_EPSILONS; tok = strtok(NULL, ","))
+    o->eps[o->neps++] = atof(tok);
+}
+
+/* Handle the driver-specific options. */
+static void parse_extra(int opt, const char *arg, void *ctx) {
+  options *o = ctx;
+  switch(opt) {
+  case 'W': o->only = arg; break;
+  case 'N': o->N = atoi(arg); break;
+  case 'm': o->ops = atol(arg); break;
+  case 'D': o->mean_inc = atof(arg); break;
+  case 'H': o->nheaps = atoi(arg); break;
+  case 'E': parse_epsilons(o, arg); break;
+  case 's': o->seed = strtoull(arg, NULL, 10); break;
+  case 'd':
+    if(!workload_parse(arg, &o->keys)) error(1,0, "unknown key distribution '%s'", arg);
+    break;
+  case 'i':
+    for(o->inc = 0; o->inc < INC_COUNT; o->inc++)
+      if(strcmp(arg, inc_names[o->inc]) == 0) break;
+    if(o->inc == INC_COUNT) error(1,0, "unknown increment distribution '%s'", arg);
+    break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  options o = { NULL, 10000, 1000000, INC_EXP, 1000, 8, { DIST_UNIFORM, 0, 0 }, { 0 }, 0, time(NULL) };
+  bench_config cfg;
+  bench_default_config(&cfg);
+  bench_parse_options(&cfg, argc, argv, "W:N:m:i:D:H:d:E:s:", parse_extra, &o);
+  if(o.N < 1 || o.ops < 1) error(1,0, "queue size and operation count must be positive");
+  if(o.nheaps < 2) o.nheaps = 2;
+
+  // By default sweep from an exact heap (epsilon just under 1/N) to a very lossy one
+  if(o.neps == 0) {
+    double defaults[] = { 0.5 / o.N, 0.01, 0.1, 0.3 };
+    o.neps = 4;
+    memcpy(o.eps, defaults, sizeof(defaults));
+  }
+
+  // Keys in the hold model grow by about mean_inc * ops / N; keep them in an int
+  if(o.mean_inc * (o.ops / (double)o.N + 10) > INT_MAX)
+    error(1,0, "hold model keys would overflow an int; lower -D or -m");
+
+  wl_state s = { &o };
+  long cycles = o.ops / (2L * o.N);
+  size_t nkeys = (size_t)o.N * (cycles > 0 ? cycles : 1);
+  if(nkeys < (size_t)o.ops) nkeys = o.ops;
+  s.prefill = malloc(o.N * sizeof(int));
+  s.incs = malloc(o.ops * sizeof(int));
+  s.keys = malloc(nkeys * sizeof(int));
+  s.opcodes = malloc(o.ops);
+  s.targets = malloc(2 * o.ops * sizeof(int));
+  s.heaps = malloc(o.nheaps * sizeof(void *));
+  s.sizes = malloc(o.nheaps * sizeof(long));
+  if(!s.prefill || !s.incs || !s.keys || !s.opcodes || !s.targets || !s.heaps || !s.sizes)
+    error(1,0, "out of memory allocating workload buffers");
+
+  bench_report_begin(&cfg);
+  for(size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    if(o.only == NULL || strcmp(o.only, workloads[i].name) == 0)
+      run_workload(&cfg, &o, &workloads[i], &s);
+
+  free(s.prefill);
+  free(s.incs);
+  free(s.keys);
+  free(s.opcodes);
+  free(s.targets);
+  free(s.heaps);
+  free(s.sizes);
+  return 0;
+}
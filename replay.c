@@ -0,0 +1,183 @@
+/* File: replay.c
+ * --------------
+ * Replays a recorded operation trace (see trace.h) against each priority
+ * queue engine at full speed under the benchmark harness, so that a
+ * production workload captured with trace_start_recording can be
+ * benchmarked offline and reproducibly.
+ *
+ *   ./replay [harness options] [-x engine] [-E epsilon] trace-file
+ *   ./replay -g trace-file [-n rounds] [-s seed]
+ *
+ * The second form records a synthetic trace of the meld-interleaving
+ * pattern from test_scraps, scaled up by rounds, as an example input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <error.h>
+
+#include "softheap.h"
+#include "bench.h"
+#include "engine.h"
+#include "trace.h"
+#include "workload.h"
+
+/* Command-line settings and the state of one replay. */
+typedef struct {
+  const pq_engine *engine;   // NULL to replay against every engine
+  double epsilon;            // override for recorded epsilons, or 0
+  const char *generate;      // if set, record a synthetic trace here instead
+  int rounds;
+  uint64_t seed;
+
+  trace t;
+  const pq_engine *current;
+  void **heaps;
+} replay_state;
+
+/* Timed body: drive the current engine through every record of the trace. */
+static void replay_run(void *ctx) {
+  replay_state *s = ctx;
+  const pq_engine *e = s->current;
+  void **heaps = s->heaps;
+
+  for(size_t i = 0; i < s->t.nrecords; i++) {
+    const trace_record *r = &s->t.records[i];
+    switch(r->op) {
+    case TRACE_CREATE:
+      heaps[r->heap] = e->create(s->epsilon > 0 ? s->epsilon : trace_epsilon(r));
+      break;
+    case TRACE_INSERT:
+      e->insert(heaps[r->heap], r->arg);
+      break;
+    case TRACE_EXTRACT:
+      e->extract(heaps[r->heap]);
+      break;
+    case TRACE_MELD:
+      heaps[r->heap] = e->meld(heaps[r->heap], heaps[r->arg]);
+      heaps[r->arg] = NULL;
+      break;
+    case TRACE_DESTROY:
+      e->destroy(heaps[r->heap]);
+      heaps[r->heap] = NULL;
+      break;
+    default:
+      error(1,0, "record %zu: unknown trace operation %d", i, r->op);
+    }
+  }
+}
+
+/* Untimed teardown: destroy whatever heaps the trace left alive. */
+static void replay_teardown(void *ctx) {
+  replay_state *s = ctx;
+  for(int i = 0; i < s->t.nheaps; i++) {
+    if(s->heaps[i] != NULL) s->current->destroy(s->heaps[i]);
+    s->heaps[i] = NULL;
+  }
+}
+
+/* Record a synthetic trace: two heaps with small positive and negative keys
+ * built up unevenly, partly drained, melded, and then churned, as in
+ * test_scraps. Each round repeats the pattern on a fresh pair of heaps. */
+static void generate_trace(replay_state *s) {
+  rng g;
+  rng_seed(&g, s->seed);
+  if(!trace_start_recording(s->generate)) error(1,0, "cannot record trace to %s", s->generate);
+
+  for(int round = 0; round < s->rounds; round++) {
+    softheap *P = makeheap_empty(0.99);
+    softheap *Q = makeheap_empty(0.99);
+    int count = 0;
+
+    for(int i = 0; i < 100; i++) {
+      int j1 = rng_below(&g, 3), j2 = rng_below(&g, 3);
+      for(int j = 0; j < j1; j++, count++) insert(P, -(int)rng_below(&g, 30));
+      for(int j = 0; j < j2; j++, count++) insert(P, rng_below(&g, 30));
+    }
+    for(int i = 0; i < 100; i++) {
+      int j1 = rng_below(&g, 5), j2 = rng_below(&g, 5);
+      for(int j = 0; j < j1; j++, count++) insert(Q, -(int)rng_below(&g, 30));
+      for(int j = 0; j < j2; j++, count++) insert(Q, rng_below(&g, 30));
+    }
+
+    // Drain both heaps a little, never extracting from an empty one
+    for(int i = 0; i < 100; i++) {
+      if(!empty(P)) { extract_min(P); count--; }
+      if(!empty(Q)) { extract_min(Q); count--; }
+    }
+
+    Q = meld(P, Q);
+
+    for(; count > 30; count--) {
+      insert(Q, -(int)rng_below(&g, 30));
+      extract_min(Q);
+      insert(Q, rng_below(&g, 30));
+      extract_min(Q);
+      extract_min(Q);
+    }
+
+    destroy_heap(Q);
+  }
+
+  size_t n = trace_stop_recording();
+  fprintf(stderr, "Recorded %zu operations to %s\n", n, s->generate);
+}
+
+/* Handle the driver-specific options. */
+static void parse_extra(int opt, const char *arg, void *ctx) {
+  replay_state *s = ctx;
+  switch(opt) {
+  case 'x':
+    s->engine = engine_find(arg);
+    if(s->engine == NULL) error(1,0, "unknown engine '%s'", arg);
+    break;
+  case 'E': s->epsilon = atof(arg); break;
+  case 'g': s->generate = arg; break;
+  case 'n': s->rounds = atoi(arg); break;
+  case 's': s->seed = strtoull(arg, NULL, 10); break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  replay_state s = { .rounds = 1000, .seed = time(NULL) };
+  bench_config cfg;
+  bench_default_config(&cfg);
+  int argi = bench_parse_options(&cfg, argc, argv, "x:E:g:n:s:", parse_extra, &s);
+
+  if(s.generate != NULL) {
+    generate_trace(&s);
+    return 0;
+  }
+
+  if(argc - argi != 1) {
+    bench_usage(stderr);
+    error(1,0, "usage: ./replay [options] [-x engine] [-E epsilon] trace-file\n"
+               "       ./replay -g trace-file [-n rounds] [-s seed]");
+  }
+  const char *path = argv[argi];
+  if(!trace_load(path, &s.t)) error(1,0, "cannot load trace %s", path);
+  s.heaps = calloc(s.t.nheaps > 0 ? s.t.nheaps : 1, sizeof(void *));
+  if(s.heaps == NULL) error(1,0, "out of memory allocating heap table");
+
+  char param[64];
+  if(s.epsilon > 0) snprintf(param, sizeof(param), "eps=%g", s.epsilon);
+  else snprintf(param, sizeof(param), "eps=recorded");
+
+  bench_ops ops = { NULL, replay_run, replay_teardown };
+  bench_report_begin(&cfg);
+  for(int i = 0; i < num_engines; i++) {
+    if(s.engine != NULL && s.engine != all_engines[i]) continue;
+    s.current = all_engines[i];
+
+    bench_result res;
+    bench_run(&cfg, &ops, &s, s.t.nrecords, &res);
+    bench_report(&cfg, "replay", s.current->name, s.current->uses_epsilon ? param : "",
+                 s.t.nrecords, &res);
+  }
+
+  free(s.heaps);
+  trace_free(&s.t);
+  return 0;
+}
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <string.h>
 #include "softheap.h"
 
 
@@ -29,6 +30,24 @@ static void report_corruptions(int ckey_corruptions, int pos_corruptions, int ne
   printf("\n");
 }
 
+/* In an audit build (make AUDIT=1), check that the heap's own count of
+ * corrupted extractions agrees with the one the test kept by comparing
+ * keys with ckeys. The live epsilon * n check has run on every operation. */
+static void check_audit(softheap *P, int ckey_corruptions) {
+  if(!softheap_audit_enabled()) return;
+  softheap_audit a;
+  softheap_get_audit(P, &a);
+  printf("Audit: at most %ld corrupted at once (bound %.0f), mean inflation %.2f, max %ld\n",
+         a.max_corrupted, EPSILON * a.inserts,
+         a.corrupted_extractions ? a.total_inflation / a.corrupted_extractions : 0, a.max_inflation);
+  if(a.corrupted_extractions != ckey_corruptions || a.corrupted != 0) {
+    fprintf(stderr, "Audit mismatch: heap counted %ld corrupted extractions, test counted %d\n",
+            a.corrupted_extractions, ckey_corruptions);
+    exit(1);
+  }
+  printf("\n");
+}
+
 
 /* Simple usage pattern: Insert increasing sequence of integers and then extract all. */
 static void forwards_test(int elems[], int results[][2]) {
@@ -49,6 +68,7 @@ static void forwards_test(int elems[], int results[][2]) {
   }
 
   report_corruptions(ckey_corruptions, pos_corruptions, N_ELEMENTS);  
+  check_audit(P, ckey_corruptions);
   free(P);
 }
 
@@ -71,6 +91,7 @@ static void backwards_test(int elems[], int results[][2]) {
   }
   
   report_corruptions(ckey_corruptions, pos_corruptions, N_ELEMENTS);  
+  check_audit(P, ckey_corruptions);
   free(P);
 }
 
@@ -101,6 +122,7 @@ static void coprime_test(int elems[], int results[][2]) {
   }
   
   report_corruptions(ckey_corruptions, pos_corruptions, N_ELEMENTS);  
+  check_audit(P, ckey_corruptions);
   free(P);
 }
 
@@ -129,7 +151,364 @@ static void random_test(int elems[], int results[][2]) {
   }
   
   report_corruptions(ckey_corruptions, pos_corruptions, N_ELEMENTS);  
+  check_audit(P, ckey_corruptions);
+  free(P);
+}
+
+/* Insert the same random numbers into two heaps and extract them all, one
+ * heap with extract_min_with_ckey and the other with extract_min_ex. The
+ * heaps evolve identically, so each extract_min_ex item must carry the same
+ * key and ckey as its twin, and be flagged corrupted exactly when they differ. */
+static void extract_ex_test(int elems[], int results[][2]) {
+  printf("----------EXTRACT_MIN_EX TEST----------\n");
+  printf("Inserting %d random integers into two soft heaps...\n", N_ELEMENTS);
+  srand(time(NULL));
+
+  softheap *P = makeheap_empty(EPSILON), *Q = makeheap_empty(EPSILON);
+  for(int i = 0; i < N_ELEMENTS; i++) {
+    elems[i] = rand();
+    insert(P, elems[i]);
+    insert(Q, elems[i]);
+  }
+
+  printf("Extracting elements with extract_min_ex...\n");
+  int ckey_corruptions = 0, mismatches = 0;
+  for(int i = 0; i < N_ELEMENTS; i++) {
+    softheap_item item;
+    results[i][0] = extract_min_with_ckey(P, &results[i][1]);
+    int key = extract_min_ex(Q, &item);
+    if(key != results[i][0] || item.key != key || item.ckey != results[i][1] ||
+       item.corrupted != (item.ckey != item.key)) mismatches++;
+    if(item.corrupted) ckey_corruptions++;
+  }
+  if(mismatches != 0 || !empty(Q)) {
+    fprintf(stderr, "extract_min_ex disagreed with extract_min_with_ckey %d times\n", mismatches);
+    exit(1);
+  }
+
+  printf("All %d items matched, %d of them flagged corrupted.\n\n", N_ELEMENTS, ckey_corruptions);
+  check_audit(Q, ckey_corruptions);
   free(P);
+  free(Q);
+}
+
+/* Fill a bounded heap and an ordinary one with random numbers, meld them
+ * (which gives a bounded heap) and extract everything. Deferring repairs
+ * must not break the soft heap's promises: every ckey bounds its element,
+ * ckeys come out in order, and the elements are exactly those inserted. */
+static void bounded_test(int elems[], int results[][2]) {
+  printf("----------BOUNDED TEST-----------\n");
+  printf("Inserting %d random integers into a bounded and an ordinary soft heap...\n", N_ELEMENTS);
+  srand(time(NULL));
+
+  softheap *P = makeheap_bounded(EPSILON, 2), *Q = makeheap_empty(EPSILON);
+  softheap_set_free_mode(P, SOFTHEAP_FREE_BACKGROUND); // and exercise deferred frees on the way
+  softheap_set_free_mode(Q, SOFTHEAP_FREE_DEFERRED);
+  for(int i = 0; i < N_ELEMENTS; i++) {
+    elems[i] = rand();
+    insert(i % 4 ? P : Q, elems[i]);
+  }
+  P = meld(P, Q);
+  qsort(elems, N_ELEMENTS, sizeof(int), intcmp);
+
+  printf("Melding them and extracting elements with ckeys...\n");
+  int ckey_corruptions = 0, pos_corruptions = 0, violations = 0;
+  for(int i = 0; i < N_ELEMENTS; i++) {
+    results[i][0] = extract_min_with_ckey(P, &results[i][1]);
+    if(results[i][0] < results[i][1]) ckey_corruptions++;
+    if(results[i][0] > results[i][1] || (i > 0 && results[i][1] < results[i - 1][1])) violations++;
+    if(results[i][0] != elems[i]) pos_corruptions++;
+  }
+  for(int i = 0; i < N_ELEMENTS; i++) results[i][1] = results[i][0];
+  qsort(results, N_ELEMENTS, sizeof(*results), intcmp);
+  for(int i = 0; i < N_ELEMENTS; i++)
+    if(results[i][0] != elems[i]) violations++;
+  if(violations != 0 || !empty(P)) {
+    fprintf(stderr, "Bounded heap broke the soft heap invariants %d times\n", violations);
+    exit(1);
+  }
+
+  report_corruptions(ckey_corruptions, pos_corruptions, N_ELEMENTS);  
+  check_audit(P, ckey_corruptions);
+  destroy_heap(P);
+}
+
+/* Meld a large bounded heap that frees at once with a one-element bounded
+ * heap that defers its frees. The small heap is the one retired by the meld,
+ * so the repairs the meld runs afterwards must defer their frees to the
+ * result and not to the retired heap. Then drain the result and check that
+ * nothing was lost. */
+static void retired_defer_test(int elems[], int results[][2]) {
+  printf("----------RETIRED DEFER TEST-----------\n");
+  int n = N_ELEMENTS / 16;
+  printf("Melding a bounded heap of %d random integers with a one-element heap that defers frees...\n", n + 1);
+  srand(time(NULL));
+
+  softheap *P = makeheap_bounded(0.4, 1), *Q = makeheap_bounded(0.4, 1);
+  softheap_set_free_mode(Q, SOFTHEAP_FREE_DEFERRED);
+  for(int i = 0; i < n; i++) insert(P, elems[i] = rand());
+  for(int i = 0; i < 5; i++) elems[i] = extract_min(P);
+  insert(Q, elems[n] = rand());
+  P = meld(P, Q);
+
+  for(int i = 5; i <= n; i++) elems[i] = extract_min(P);
+  for(int i = 0; i <= n; i++) results[i][0] = results[i][1] = elems[i];
+  if(!empty(P) || softheap_reclaim(P) == 0) {
+    fprintf(stderr, "Meld result lost elements or deferred frees\n");
+    exit(1);
+  }
+  destroy_heap(P);
+  printf("Success!\n\n");
+}
+
+/* Check softheap_get_shape against heaps whose shape is known. With epsilon
+ * below 1/n, 2^k inserts leave a single tree of rank k in which every node
+ * holds exactly one uncorrupted item. Then walk one of two identical heaps
+ * all through a mixed workload and check that the walk counts every item
+ * and never changes what the heap extracts or the operation counters. */
+static void shape_test() {
+  printf("----------SHAPE TEST-------------\n");
+  int k = 12, n = 1 << k;
+  printf("Checking the shape of a soft heap after %d exact inserts...\n", n);
+  srand(time(NULL));
+
+  softheap *P = makeheap_empty(SORTED_EPSILON);
+  for(int i = 0; i < n; i++) insert(P, rand());
+  softheap_shape s;
+  softheap_get_shape(P, &s);
+  long nodes = 0, items = 0;
+  int errors = 0;
+  for(int j = 0; j < SOFTHEAP_MAX_RANK; j++) {
+    if(s.items_by_rank[j] != s.nodes_by_rank[j]) errors++;
+    if(s.nodes_by_rank[j] > 0 && s.size_by_rank[j] != 1) errors++;
+    nodes += s.nodes_by_rank[j];
+    items += s.items_by_rank[j];
+  }
+  if(s.ntrees != 1 || s.rank != k || s.trees_by_rank[k] != 1 || s.nodes_by_rank[k] != 1) errors++;
+  if(nodes != n || items != n || s.nnodes != n || s.nitems != n) errors++;
+  if(s.corrupted != 0 || s.max_inflation != 0) errors++;
+  destroy_heap(P);
+
+  printf("Walking one of two identical soft heaps through inserts and extractions...\n");
+  P = makeheap_empty(EPSILON);
+  softheap *Q = makeheap_empty(EPSILON);
+  int size = 0, mismatches = 0;
+  softheap_stats before, after;
+  for(int round = 0; round < 8; round++) {
+    for(int i = 0; i < n; i++, size++) {
+      int num = rand();
+      insert(P, num);
+      insert(Q, num);
+    }
+    for(int i = 0; i < n / 2; i++, size--) {
+      int ckey_p, ckey_q;
+      int p = extract_min_with_ckey(P, &ckey_p), q = extract_min_with_ckey(Q, &ckey_q);
+      if(p != q || ckey_p != ckey_q) mismatches++;
+    }
+    softheap_get_stats(&before);
+    softheap_get_shape(P, &s);
+    softheap_get_stats(&after);
+    if(s.nitems != size || memcmp(&before, &after, sizeof(before)) != 0) errors++;
+  }
+  while(!empty(Q)) {
+    int ckey_p, ckey_q;
+    int p = extract_min_with_ckey(P, &ckey_p), q = extract_min_with_ckey(Q, &ckey_q);
+    if(p != q || ckey_p != ckey_q) mismatches++;
+  }
+  if(errors != 0 || mismatches != 0 || !empty(P)) {
+    fprintf(stderr, "Shape walk was wrong %d times and changed the heap %d times\n", errors, mismatches);
+    exit(1);
+  }
+  destroy_heap(P);
+  destroy_heap(Q);
+  printf("Success!\n\n");
+}
+
+/* Insert keys from..to (inclusive, counting down if from > to) into P and,
+ * unless elems is NULL, record them in elems from position *n on. */
+static void insert_run(softheap *P, int from, int to, int elems[], int *n) {
+  int step = (from <= to ? 1 : -1);
+  for(int key = from; key != to + step; key += step) {
+    insert(P, key);
+    if(elems != NULL) elems[(*n)++] = key;
+  }
+}
+
+/* Count the leaves of P. */
+static long count_leaves(softheap *P) {
+  softheap_shape s;
+  softheap_get_shape(P, &s);
+  return s.nleaves;
+}
+
+/* Exercise the presorted-run fast path. A run inserted with detection on
+ * must sit in the buffer (items but few nodes). Once flushed, by a meld
+ * with another heap's run still buffered, it must be in trees built whole:
+ * these split their keys evenly between children, so they have more leaves
+ * than the trees the same inserts give without detection. Long ascending and descending
+ * runs then fill the buffer several times over. Draining the heap must give
+ * back every key, with ckeys that bound their keys and never decrease, and
+ * no more than epsilon * n items may be corrupted at any point. */
+static void runs_test(int elems[], int results[][2]) {
+  printf("----------RUNS TEST--------------\n");
+  int m = 3000, n = 0;
+  printf("Inserting ascending and descending runs with run detection on...\n");
+
+  softheap *P = makeheap_empty(EPSILON), *Q = makeheap_empty(EPSILON);
+  softheap *plain_P = makeheap_empty(EPSILON), *plain_Q = makeheap_empty(EPSILON);
+  softheap_detect_runs(P, true);
+  softheap_detect_runs(Q, true);
+  insert_run(P, 0, m - 1, elems, &n);
+  insert_run(Q, 2 * m - 1, m, elems, &n);
+  insert_run(plain_P, 0, m - 1, NULL, NULL);
+  insert_run(plain_Q, 2 * m - 1, m, NULL, NULL);
+
+  int errors = 0;
+  softheap_shape s;
+  softheap_get_shape(P, &s);
+  if(s.nitems != m || s.nnodes >= m / 2) errors++; // the run is buffered, not in nodes
+  P = meld(P, Q);
+  plain_P = meld(plain_P, plain_Q);
+  long leaves = count_leaves(P), plain_leaves = count_leaves(plain_P);
+  if(leaves <= plain_leaves) errors++;
+  destroy_heap(plain_P);
+  printf("After the meld: %ld leaves, against %ld without run detection\n", leaves, plain_leaves);
+
+  insert_run(P, 2 * m, 2 * m + N_ELEMENTS / 4, elems, &n);
+  insert_run(P, -1, -N_ELEMENTS / 4, elems, &n);
+  qsort(elems, n, sizeof(int), intcmp);
+
+  printf("Extracting %d elements with ckeys...\n", n);
+  int ckey_corruptions = 0, pos_corruptions = 0, violations = 0;
+  for(int i = 0; i < n; i++) {
+    if(i % (n / 16) == 0) {
+      softheap_get_shape(P, &s);
+      if(s.corrupted > EPSILON * n) violations++;
+    }
+    results[i][0] = extract_min_with_ckey(P, &results[i][1]);
+    if(results[i][0] < results[i][1]) ckey_corruptions++;
+    if(results[i][0] > results[i][1] || (i > 0 && results[i][1] < results[i - 1][1])) violations++;
+    if(results[i][0] != elems[i]) pos_corruptions++;
+  }
+  for(int i = 0; i < n; i++) results[i][1] = results[i][0];
+  qsort(results, n, sizeof(*results), intcmp);
+  for(int i = 0; i < n; i++)
+    if(results[i][0] != elems[i]) violations++;
+  if(errors != 0 || violations != 0 || !empty(P)) {
+    fprintf(stderr, "Run detection failed %d checks and broke the soft heap invariants %d times\n",
+            errors, violations);
+    exit(1);
+  }
+
+  report_corruptions(ckey_corruptions, pos_corruptions, n);
+  check_audit(P, ckey_corruptions);
+  destroy_heap(P);
+}
+
+/* Build two identical heaps and drain 90% of each, then compact one of them
+ * and check that both go on to produce exactly the same elements and ckeys,
+ * through further inserts, a meld, a second compaction and a full drain. */
+static void compact_test() {
+  printf("----------COMPACT TEST-----------\n");
+  int n = N_ELEMENTS / 4;
+  printf("Draining 90%% of two copies of a %d-element soft heap and compacting one...\n", n);
+  srand(time(NULL));
+
+  softheap *P = makeheap_empty(EPSILON), *Q = makeheap_empty(EPSILON);
+  for(int i = 0; i < n; i++) {
+    int num = rand();
+    insert(P, num);
+    insert(Q, num);
+  }
+
+  int mismatches = 0, remaining = n;
+  for(int round = 0; round < 3; round++) {
+    for(; remaining > n / 10; remaining--) {
+      int ckey_p, ckey_q;
+      int p = extract_min_with_ckey(P, &ckey_p), q = extract_min_with_ckey(Q, &ckey_q);
+      if(p != q || ckey_p != ckey_q) mismatches++;
+    }
+    softheap_compact(P);
+
+    // Refill both, partly through a meld with a heap that is itself compacted
+    softheap *R = makeheap_empty(EPSILON), *S = makeheap_empty(EPSILON);
+    for(int i = 0; i < n; i++, remaining++) {
+      int num = rand();
+      insert(i % 2 ? P : R, num);
+      insert(i % 2 ? Q : S, num);
+    }
+    softheap_compact(R);
+    P = meld(P, R);
+    Q = meld(Q, S);
+  }
+
+  for(; remaining > 0; remaining--) {
+    int ckey_p, ckey_q;
+    int p = extract_min_with_ckey(P, &ckey_p), q = extract_min_with_ckey(Q, &ckey_q);
+    if(p != q || ckey_p != ckey_q) mismatches++;
+  }
+  if(!empty(P) || !empty(Q) || mismatches != 0) {
+    fprintf(stderr, "Compaction changed the heap: %d mismatched extractions\n", mismatches);
+    exit(1);
+  }
+  destroy_heap(P);
+  destroy_heap(Q);
+  printf("Success!\n\n");
+}
+
+/* A client object queued in an intrusive soft heap, with its hook in the
+ * middle so that softheap_entry has an offset to undo. */
+typedef struct {
+  int key;
+  softheap_hook hook;
+  int seen;
+} job;
+
+/* Queue random jobs in two intrusive heaps by their embedded hooks, compact
+ * one, meld them and drain everything. Every job must come back exactly once,
+ * through its own hook, with its key untouched, a ckey that bounds it and
+ * ckeys in order. Destroying a heap that still holds jobs must leave them be. */
+static void intrusive_test() {
+  printf("----------INTRUSIVE TEST---------\n");
+  int n = N_ELEMENTS / 4;
+  printf("Queueing %d random jobs in intrusive soft heaps...\n", n);
+  srand(time(NULL));
+
+  job *jobs = malloc(n * sizeof(job));
+  if(jobs == NULL) {
+    fprintf(stderr, "Out of memory allocating jobs\n");
+    exit(1);
+  }
+  softheap *P = makeheap_intrusive(EPSILON), *Q = makeheap_intrusive(EPSILON);
+  for(int i = 0; i < n; i++) {
+    jobs[i].key = jobs[i].hook.key = rand();
+    jobs[i].seen = 0;
+    insert_hook(i % 2 ? P : Q, &jobs[i].hook);
+  }
+  softheap_compact(Q);
+  P = meld(P, Q);
+
+  int ckey_corruptions = 0, violations = 0, last = -1;
+  for(int i = 0; i < n; i++) {
+    int ckey;
+    job *j = softheap_entry(extract_min_hook(P, &ckey), job, hook);
+    if(j < jobs || j >= jobs + n || j->seen++ || j->hook.key != j->key || j->key > ckey || ckey < last)
+      violations++;
+    if(j->key < ckey) ckey_corruptions++;
+    last = ckey;
+  }
+  if(violations != 0 || !empty(P)) {
+    fprintf(stderr, "Intrusive heap broke the soft heap invariants %d times\n", violations);
+    exit(1);
+  }
+  check_audit(P, ckey_corruptions);
+  destroy_heap(P);
+
+  Q = makeheap_intrusive(EPSILON);
+  for(int i = 0; i < n; i++) insert_hook(Q, &jobs[i].hook);
+  destroy_heap(Q);
+  free(jobs);
+  printf("Success!\n\n");
 }
 
 /* Make sure heap destruction isn't broken */
@@ -158,14 +537,28 @@ static void cleanup_test() {
 }
 
 int main() {
-  int sorted[N_ELEMENTS];
-  int results[N_ELEMENTS][2];
+  // 12 MB of buffers: too big for the stack
+  int *sorted = malloc(N_ELEMENTS * sizeof(int));
+  int (*results)[2] = malloc(N_ELEMENTS * sizeof(*results));
+  if(sorted == NULL || results == NULL) {
+    fprintf(stderr, "Out of memory allocating test buffers\n");
+    return 1;
+  }
   
   forwards_test(sorted, results);
   backwards_test(sorted, results);
   coprime_test(sorted, results);
   random_test(sorted, results);
+  extract_ex_test(sorted, results);
+  bounded_test(sorted, results);
+  retired_defer_test(sorted, results);
+  shape_test();
+  runs_test(sorted, results);
+  compact_test();
+  intrusive_test();
   cleanup_test();
 
+  free(sorted);
+  free(results);
   return 0;
 }
@@ -0,0 +1,207 @@
+/* File: scaling.c
+ * ---------------
+ * Scaling study: runs every sorter from sorts.c and every priority queue
+ * engine (as a heapsort: n inserts then n extracts) at sizes from 10^3 to
+ * 10^9 in geometric steps, reporting ns/item and peak memory per item.
+ * Input and output buffers come from bench_alloc (mmap, 2 MB aligned, huge
+ * pages where available), so nothing large ever lives on the stack. Before
+ * each measurement the footprint is extrapolated from the previous size,
+ * and measurements that would not fit in available memory are skipped.
+ *
+ *   ./scaling [harness options] [-n min] [-N max] [-k steps-per-decade]
+ *             [-d dist] [-E lossy-eps] [-S name] [-s seed]
+ */
+
+#define SORTS_NO_MAIN
+#include "sorts.c"
+
+#include <limits.h>
+#include <malloc.h>
+
+#include "engine.h"
+
+/* One thing to measure: a sorter, or an engine draining into the output
+ * buffer. For the soft heap, epsilon 0 means an exact heap (1/n). */
+typedef struct {
+  const char *name;
+  sorter sort;
+  const pq_engine *engine;
+  double epsilon;
+  double extra_per_item;   // peak memory beyond the buffers at the previous size
+} subject;
+
+#define MAX_SUBJECTS 16
+
+/* Size at which footprints are calibrated when the study starts above it,
+ * and the margin by which extrapolated footprints are inflated. */
+#define CALIBRATION_N 100000
+#define FOOTPRINT_MARGIN 1.25
+
+/* Command-line settings. */
+typedef struct {
+  long min_n, max_n;
+  int steps;
+  workload_spec spec;
+  double lossy_eps;
+  const char *only;
+  uint64_t seed;
+} options;
+
+/* State of one engine measurement. */
+typedef struct {
+  const pq_engine *engine;
+  double epsilon;
+  const int *A;
+  int *B;
+  size_t length;
+  void *pq;
+} engine_bench;
+
+/* Timed body: insert the template array and extract everything into B. */
+static void engine_run(void *ctx) {
+  engine_bench *eb = ctx;
+  const pq_engine *e = eb->engine;
+  eb->pq = e->create(eb->epsilon);
+  for(size_t i = 0; i < eb->length; i++) e->insert(eb->pq, eb->A[i]);
+  for(size_t i = 0; i < eb->length; i++) eb->B[i] = e->extract(eb->pq);
+}
+
+static void engine_teardown(void *ctx) {
+  engine_bench *eb = ctx;
+  eb->engine->destroy(eb->pq);
+  eb->pq = NULL;
+}
+
+/* Measure one subject on A (length n) with B as scratch/output, attach the
+ * memory metrics and report them unless quiet is set. Returns the peak
+ * memory per item beyond the two buffers. */
+static double measure(const bench_config *cfg, subject *sub, int *A, int *B, size_t n,
+                      const char *dist, bool quiet) {
+  char param[96];
+  bench_result res;
+  bool exact = true;
+
+  malloc_trim(0); // hand back whatever the previous subject freed
+  bench_reset_peak_rss();
+  size_t base = bench_rss();
+
+  if(sub->sort != NULL) {
+    sort_bench sb = { A, B, n, sub->sort };
+    bench_ops ops = { sort_setup, sort_run, NULL };
+    bench_run(cfg, &ops, &sb, n, &res);
+    snprintf(param, sizeof(param), "%s", dist);
+  } else {
+    engine_bench eb = { sub->engine, sub->epsilon > 0 ? sub->epsilon : 0.5 / n, A, B, n };
+    bench_ops ops = { NULL, engine_run, engine_teardown };
+    bench_run(cfg, &ops, &eb, n, &res);
+    exact = (sub->epsilon <= 0 || !sub->engine->uses_epsilon);
+    if(sub->engine->uses_epsilon) snprintf(param, sizeof(param), "%s;eps=%.3g", dist, eb.epsilon);
+    else snprintf(param, sizeof(param), "%s", dist);
+  }
+
+  size_t peak = bench_peak_rss();
+  double extra = (peak > base ? (double)(peak - base) / n : 0);
+  if(exact && !sorted(B, n)) error(1,0, "%s failed to sort", sub->name);
+
+  bench_add_metric(&res, "bytes_per_item", extra + 2 * sizeof(int));
+  bench_add_metric(&res, "extra_per_item", extra);
+  if(!quiet) bench_report(cfg, "scaling", sub->name, param, n, &res);
+  return extra;
+}
+
+/* Run every subject once at a small size, unreported, to learn its
+ * footprint per item before the first real size is attempted. */
+static void calibrate(const bench_config *cfg, subject *subjects, int nsubjects, const options *o) {
+  size_t n = CALIBRATION_N;
+  bench_config quick = *cfg;
+  quick.min_reps = quick.max_reps = 1;
+
+  int *A = bench_alloc(n * sizeof(int)), *B = bench_alloc(n * sizeof(int));
+  rng g;
+  rng_seed(&g, o->seed);
+  workload_fill(A, n, &o->spec, &g);
+  for(int i = 0; i < nsubjects; i++)
+    subjects[i].extra_per_item = measure(&quick, &subjects[i], A, B, n, "", true);
+  bench_free(A, n * sizeof(int));
+  bench_free(B, n * sizeof(int));
+}
+
+/* Handle the driver-specific options. */
+static void parse_options(int opt, const char *arg, void *ctx) {
+  options *o = ctx;
+  switch(opt) {
+  case 'n': o->min_n = atof(arg); break;
+  case 'N': o->max_n = atof(arg); break;
+  case 'k': o->steps = atoi(arg); break;
+  case 'E': o->lossy_eps = atof(arg); break;
+  case 'S': o->only = arg; break;
+  case 's': o->seed = strtoull(arg, NULL, 10); break;
+  case 'd':
+    if(!workload_parse(arg, &o->spec)) error(1,0, "unknown key distribution '%s'", arg);
+    break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  options o = { 1000, 1000000000, 1, { DIST_UNIFORM, 0, 0 }, 0.1, NULL, time(NULL) };
+  bench_config cfg;
+  bench_default_config(&cfg);
+  cfg.warmup = 0;    // a warmup at 10^9 costs as much as a measurement
+  cfg.min_reps = 3;
+  bench_parse_options(&cfg, argc, argv, "n:N:k:d:E:S:s:", parse_options, &o);
+  if(o.min_n < 2 || o.max_n < o.min_n || o.max_n > INT_MAX) error(1,0, "need 2 <= min n <= max n < 2^31");
+  if(o.steps < 1) error(1,0, "need at least one step per decade");
+  if(!bench_reset_peak_rss()) fprintf(stderr, "Warning: cannot reset peak RSS; memory figures are upper bounds\n");
+
+  // Every sorter, then every engine; the soft heap both exact and lossy
+  subject subjects[MAX_SUBJECTS];
+  int nsubjects = 0;
+  for(size_t i = 0; i < sizeof(sorters) / sizeof(sorters[0]); i++)
+    subjects[nsubjects++] = (subject){ sorters[i].name, sorters[i].sort, NULL, 0, 0 };
+  for(int i = 0; i < num_engines; i++) {
+    subjects[nsubjects++] = (subject){ all_engines[i]->name, NULL, all_engines[i], 0, 0 };
+    if(all_engines[i]->uses_epsilon)
+      subjects[nsubjects++] = (subject){ all_engines[i]->name, NULL, all_engines[i], o.lossy_eps, 0 };
+  }
+
+  srand(o.seed);
+  char dist[64];
+  workload_describe(&o.spec, dist, sizeof(dist));
+  fprintf(stderr, "Random seed: %llu\n", (unsigned long long)o.seed);
+
+  if(o.min_n > CALIBRATION_N) calibrate(&cfg, subjects, nsubjects, &o);
+
+  bench_report_begin(&cfg);
+  for(int step = 0; ; step++) {
+    size_t n = llround(o.min_n * pow(10, (double)step / o.steps));
+    if(n > (size_t)o.max_n) break;
+
+    size_t buffers = 2 * n * sizeof(int);
+    if(buffers > 0.9 * bench_available_memory()) {
+      fprintf(stderr, "Skipping n=%zu: the input buffers alone would not fit in memory\n", n);
+      continue;
+    }
+    int *A = bench_alloc(n * sizeof(int)), *B = bench_alloc(n * sizeof(int));
+    rng g;
+    rng_seed(&g, o.seed);
+    workload_fill(A, n, &o.spec, &g);
+    memset(B, 0, n * sizeof(int)); // fault the pages in now rather than in the first subject
+
+    for(int i = 0; i < nsubjects; i++) {
+      subject *sub = &subjects[i];
+      if(o.only != NULL && strcmp(o.only, sub->name) != 0) continue;
+      double need = FOOTPRINT_MARGIN * sub->extra_per_item * n;
+      if(need > 0.9 * bench_available_memory()) {
+        fprintf(stderr, "Skipping %s at n=%zu: about %.1f GB would not fit in memory\n", sub->name, n,
+                need / 1e9);
+        continue;
+      }
+      sub->extra_per_item = measure(&cfg, sub, A, B, n, dist, false);
+    }
+
+    bench_free(A, n * sizeof(int));
+    bench_free(B, n * sizeof(int));
+  }
+
+  return 0;
+}
@@ -9,20 +9,49 @@
 #include "softheap.h"
 
 #include <stdlib.h>
+#include <stdint.h> // for uintptr_t
+#include <limits.h> // for INT_MAX
+#include <string.h> // for memset
 #include <assert.h> // for assert
 #include <error.h> // for error
 #include <math.h> // For log and ceil. Remember to link math library!
+#include <malloc.h> // for malloc_trim
+#include <pthread.h> // for the arena's lock
+#include <sys/mman.h> // for the arena's reservation
 
 /* Structure representing a soft heap. The soft heap object has access
  * to the first tree in its root list, the rank of the highest-order tree
  * in its root list, its error parameter epsilon, and the parameter
  * r(epsilon) that defines the maximum node rank for which a node 
- * is guaranteed to contain only uncorrupted elements. */
+ * is guaranteed to contain only uncorrupted elements.
+ *
+ * A bounded heap (steps > 0, see makeheap_bounded) also keeps a queue of
+ * nodes left short of items, stored as a ring buffer, which each operation
+ * refills by at most steps list moves. A heap whose frees are deferred (see
+ * softheap_set_free_mode) keeps the trees, nodes and cells it has freed on
+ * a chain until they are reclaimed. Finally, the heap tracks the monotone
+ * run its latest inserts form, and buffers long runs (see run_insert). The
+ * list cells of an intrusive heap belong to its clients. */
 typedef struct SOFTHEAP {
   struct TREE *first;
   int rank;
   double epsilon;
   int r;
+  int steps;
+  struct TREENODE **pending;
+  size_t pending_head, pending_len, pending_cap;
+  softheap_free_mode free_mode;
+  void *deferred;      // freed objects not yet given back, chained through their first word
+  void *deferred_tail;
+  size_t ndeferred;
+  bool detect_runs;
+  int run_last, run_len, run_dir; // last key inserted, length and direction of its monotone run
+  int *run;                       // keys of that run buffered for a prebuilt tree
+  int nrun;
+  bool intrusive;                 // items are client hooks, never allocated or freed here
+#ifdef SOFTHEAP_AUDIT
+  softheap_audit audit;
+#endif
 } softheap;
 
 /* Structure representing a binary tree in a soft heap's rootlist. The tree stores
@@ -48,21 +77,153 @@ typedef struct TREE {
  * but does not need access to its parent. It contains a ckey (its priority), its rank,
  * the number of elements in its list, and its "size": a parameter defined such that
  * its list always contains Theta(size) elements so long as the node is not a leaf. 
- * Its list is stored as a doubly linked list. */
+ * Its list is stored as a doubly linked list. The flags (NODE_QUEUED, NODE_DEAD) only
+ * ever get set in bounded heaps, and fit in what would otherwise be padding. */
 typedef struct TREENODE {
   struct TREENODE *left, *right;
-  struct LISTCELL *first, *last;
-  int ckey, rank, size, nelems;
+  struct softheap_hook *first, *last;
+  int ckey, size, nelems;
+  short rank;
+  unsigned char flags;
+#ifdef SOFTHEAP_AUDIT
+  int ncorrupt; // items in the list whose key is below ckey
+#endif
 } node;
 
-/* An item in a soft heap tree node's list. */
-typedef struct LISTCELL {
-  int elem;
-  struct LISTCELL *next;
-} cell;
+/* An item in a soft heap tree node's list. Cells are the public hooks, so
+ * that an intrusive heap can link its clients' hooks in directly. */
+typedef softheap_hook cell;
+
+/* Monotone runs of inserts. Once RUN_MIN consecutive inserts have been in
+ * order, later keys of the run are buffered, up to RUN_MAX of them, and
+ * turned into heap-ordered trees in one go rather than inserted one by one.
+ * RUN_MAX is a power of two, 2^RUN_MAX_RANK. */
+#define RUN_MIN 8
+#define RUN_MAX_RANK 12
+#define RUN_MAX (1 << RUN_MAX_RANK)
+
+/* Node flags. A queued node is in its heap's pending queue; a dead one was
+ * freed by the heap while queued, and is released when the queue reaches it. */
+#define NODE_QUEUED 1
+#define NODE_DEAD 2
+
+/* Operation counters. With SOFTHEAP_STATS undefined, STAT expands to nothing
+ * so the hot paths are exactly as they would be without instrumentation. */
+#ifdef SOFTHEAP_STATS
+static __thread softheap_stats stats;
+#define STAT(field) (stats.field++)
+#else
+#define STAT(field) ((void)0)
+#endif
+
+/* Corruption audit. With SOFTHEAP_AUDIT defined every node counts its
+ * corrupted items, and sift reports newly corrupted items through the
+ * per-thread audit_delta, which the public operation that triggered the
+ * sift then settles into its heap's totals (sift does not know the heap).
+ * Without it, AUDIT expands to nothing. */
+#ifdef SOFTHEAP_AUDIT
+static __thread long audit_delta;
+static void audit_settle(softheap *P, const char *op);
+static void audit_merge(softheap_audit *into, const softheap_audit *from);
+#define AUDIT(stmt) stmt
+#else
+#define AUDIT(stmt) ((void)0)
+#endif
+
+/* The observer installed by softheap_set_observer, if any. */
+static softheap_observer observer = NULL;
+static void *observer_ctx = NULL;
+
+/* Compaction arena (see softheap_compact). A large range of address space
+ * is reserved once, without backing memory, and handed out in 2 MB chunks
+ * that compaction fills with trees, nodes and cells in DFS order. Every
+ * chunk counts its live objects; when the last one is freed, the chunk's
+ * pages go back to the OS and the chunk back on a free stack. Because the
+ * reservation is one range, release tells arena objects from malloc'd ones
+ * with a single comparison, and before the first compaction (when the
+ * range is empty) everything goes to free as usual. */
+#define ARENA_CHUNK_SHIFT 21
+#define ARENA_CHUNK ((size_t)1 << ARENA_CHUNK_SHIFT)
+#define ARENA_RESERVE ((size_t)1 << 38)
+
+static char *arena_base = NULL;
+static size_t arena_reserved = 0;      // bytes reserved at arena_base, published last; 0 if none
+static long *arena_live;               // live objects per chunk
+static int *arena_free_chunks;         // stack of released chunk indices
+static int arena_nfree, arena_next;    // stack depth, and the first never-used chunk
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Where compaction is placing objects: the unused part of the current chunk. */
+typedef struct {
+  char *next, *end;
+  long *live;
+} arena_cursor;
+
+static void arena_release(void *p);
+
+/* Deferred frees (see softheap_set_free_mode). Internal code frees through
+ * release without knowing the heap, so each public operation on a heap that
+ * defers its frees points the per-thread deferring at it for the duration,
+ * as audit_delta does for the audit. Background batches of at least
+ * RECLAIM_BATCH objects go to a single reclaimer thread. */
+#define RECLAIM_BATCH 4096
+
+static __thread softheap *deferring = NULL;
+static void defer_free(softheap *P, void *p);
+static void reclaim_in_background(softheap *P);
+
+/* Function: free_object
+ * ---------------------
+ * Free a tree, node or cell now, wherever it was allocated.
+ */
+static inline void free_object(void *p) {
+  // arena_init publishes arena_reserved after everything else, so a nonzero
+  // value makes arena_base safe to read
+  size_t reserved = __atomic_load_n(&arena_reserved, __ATOMIC_ACQUIRE);
+  if(reserved != 0 && (uintptr_t)p - (uintptr_t)arena_base < reserved) arena_release(p);
+  else free(p);
+}
+
+/* Function: release
+ * -----------------
+ * Free a tree, node or cell, or set it aside if the current operation's
+ * heap defers its frees.
+ */
+static inline void release(void *p) {
+  STAT(frees);
+  if(deferring != NULL) defer_free(deferring, p);
+  else free_object(p);
+}
+
+/* Function: begin_op
+ * ------------------
+ * Called on entry to each public operation on P (and Q, for a meld), so
+ * that frees go wherever that heap wants them. end_op undoes it.
+ */
+static inline void begin_op(softheap *P, softheap *Q) {
+  if(P->free_mode != SOFTHEAP_FREE_NOW) deferring = P;
+  else if(Q != NULL && Q->free_mode != SOFTHEAP_FREE_NOW) deferring = Q;
+}
+
+static inline void end_op(void) {
+  deferring = NULL;
+}
 
 /***************************************** UTILITY FUNCTIONS **************************************/
 
+/* Function: notify
+ * ----------------
+ * Report a client-side operation to the installed observer, if there is one.
+ * Only the public entry points call this, so internal melds and heap
+ * creations (e.g. inside insert) are never reported.
+ */
+static inline void notify(softheap_op op, softheap *heap, softheap *other, softheap *result, int key) {
+  if(observer == NULL) return;
+  softheap_event ev = { op, heap, other, result, key };
+  observer(&ev, observer_ctx);
+}
+
 /* Function: leaf
  * --------------
  * Return true if and only if this soft heap tree node
@@ -130,7 +291,8 @@ static inline int get_next_size(int rank, int prevrank_size, int r) {
  */
 static cell *addcell(int elem, cell *listend) {
   cell *c = malloc(sizeof(cell));
-  c->elem = elem;
+  STAT(allocs);
+  c->key = elem;
   if(listend != NULL) listend->next = c;
   c->next = NULL;
   return c;
@@ -139,43 +301,92 @@ static cell *addcell(int elem, cell *listend) {
 /* Function: makenode
  * ------------------
  * Constructs a rank-0 soft heap binary tree node containing just the parameter
- * element. Its ckey matches the element, since that element is the only
+ * cell. Its ckey matches the cell's key, since that cell is the only
  * object in its list.
  */
-static node *makenode(int elem) {
+static node *makenode(cell *c) {
   node *x = malloc(sizeof(node));
-  x->first = x->last = addcell(elem, NULL);
-  x->ckey = elem;
+  STAT(allocs);
+  x->first = x->last = c;
+  x->ckey = c->key;
   x->rank = 0;
   x->size = x->nelems = 1;
   x->left = x->right = NULL;
+  x->flags = 0;
+  AUDIT(x->ncorrupt = 0);
   return x;
 }
 
 /* Function: maketree
  * ------------------
  * Constructs a soft heap binary tree consisting of exactly one node
- * housing the parameter element.
+ * housing the parameter cell.
  */
-static tree *maketree(int elem) {
+static tree *maketree(cell *c) {
   tree *T = malloc(sizeof(tree));
-  T->root = makenode(elem);
+  STAT(allocs);
+  STAT(trees_created);
+  T->root = makenode(c);
   T->prev = T->next = NULL;
   T->rank = 0;
   T->sufmin = T;
   return T;
 }
 
-/* Function: makeheap
+/* Function: new_heap
  * ------------------
- * Construct a soft heap with error parameter epsilon containing element elem.
+ * Constructs an empty soft heap with the provided error parameter.
+ * Internal constructor shared by the public ones, which additionally
+ * notify the observer.
+ */
+static softheap *new_heap(double epsilon) {
+  // Ensure error parameter is valid
+  if(epsilon <= 0 || epsilon >= 1) error(1,0, "Soft heap error parameter must fall in (0,1)");
+  
+  softheap *s = malloc(sizeof(softheap));
+  STAT(allocs);
+  s->first = NULL;
+  s->rank = -1; // Ensures that any insertion will just return the SH containing the inserted elem
+  s->epsilon = epsilon;
+  s->r = get_r(epsilon);
+  s->steps = 0;
+  s->pending = NULL;
+  s->pending_head = s->pending_len = s->pending_cap = 0;
+  s->free_mode = SOFTHEAP_FREE_NOW;
+  s->deferred = s->deferred_tail = NULL;
+  s->ndeferred = 0;
+  s->detect_runs = false;
+  s->run_last = s->run_len = s->run_dir = s->nrun = 0;
+  s->run = NULL;
+  s->intrusive = false;
+  AUDIT(memset(&s->audit, 0, sizeof(s->audit)));
+  return s;
+}
+
+/* Function: singleton_heap
+ * ------------------------
+ * Construct a soft heap with error parameter epsilon containing cell c.
  * This is done by constructing a tree of rank 0 containing a single rank-0
  * node. The node has one item in its item list, which is the item inserted.
  */
-softheap *makeheap(int elem, double epsilon) {
-  softheap *s = makeheap_empty(epsilon);
-  s->first = maketree(elem);
+static softheap *singleton_heap(cell *c, double epsilon) {
+  softheap *s = new_heap(epsilon);
+  s->first = maketree(c);
   s->rank = 0;
+  AUDIT(s->audit.inserts = 1);
+  return s;
+}
+
+/* Function: makeheap
+ * ------------------
+ * Construct a soft heap with error parameter epsilon containing element elem.
+ * To an observer this looks like the creation of an empty heap followed by
+ * an insertion.
+ */
+softheap *makeheap(int elem, double epsilon) {
+  softheap *s = singleton_heap(addcell(elem, NULL), epsilon);
+  notify(SH_OP_CREATE, s, NULL, s, 0);
+  notify(SH_OP_INSERT, s, NULL, s, elem);
   return s;
 }
 
@@ -184,36 +395,56 @@ softheap *makeheap(int elem, double epsilon) {
  * Constructs an empty soft heap with the provided error parameter.
  */
 softheap *makeheap_empty(double epsilon) {
-  // Ensure error parameter is valid
-  if(epsilon <= 0 || epsilon >= 1) error(1,0, "Soft heap error parameter must fall in (0,1)");
-  
-  softheap *s = malloc(sizeof(softheap));
-  s->first = NULL;
-  s->rank = -1; // Ensures that any insertion will just return the SH containing the inserted elem
-  s->epsilon = epsilon;
-  s->r = get_r(epsilon);
+  softheap *s = new_heap(epsilon);
+  notify(SH_OP_CREATE, s, NULL, s, 0);
+  return s;
+}
+
+/* Function: makeheap_bounded
+ * --------------------------
+ * Construct an empty soft heap with error parameter epsilon that does at
+ * most steps list moves of deferred repair work per operation.
+ */
+softheap *makeheap_bounded(double epsilon, int steps) {
+  if(steps < 1) error(1,0, "A bounded soft heap needs at least one step per operation");
+  softheap *s = new_heap(epsilon);
+  s->steps = steps;
+  notify(SH_OP_CREATE, s, NULL, s, 0);
+  return s;
+}
+
+/* Function: makeheap_intrusive
+ * ----------------------------
+ * Construct an empty soft heap with error parameter epsilon whose items
+ * are client hooks. Run detection buffers int keys, so softheap_detect_runs
+ * cannot turn it on.
+ */
+softheap *makeheap_intrusive(double epsilon) {
+  softheap *s = new_heap(epsilon);
+  s->intrusive = true;
+  notify(SH_OP_CREATE, s, NULL, s, 0);
   return s;
 }
 
 /* Function: destroy_node
  * ----------------------
- * Deallocates all the cells in this node's item list,
- * recursively destroys its left and right children, 
+ * Deallocates all the cells in this node's item list (unless they
+ * are client hooks), recursively destroys its left and right children,
  * then deallocates its memory. For use in destroy_heap.
  */
-static void destroy_node(node *treenode) {
+static void destroy_node(node *treenode, bool free_cells) {
   if(treenode == NULL) return;
   
   cell *curr = treenode->first, *next;
-  while(curr != NULL) {
+  while(curr != NULL && free_cells) {
     next = curr->next;
-    free(curr);
+    release(curr);
     curr = next;
   }
 
-  destroy_node(treenode->left);
-  destroy_node(treenode->right);
-  free(treenode);
+  destroy_node(treenode->left, free_cells);
+  destroy_node(treenode->right, free_cells);
+  release(treenode);
 }
 
 /* Function: destroy_heap
@@ -224,18 +455,148 @@ static void destroy_node(node *treenode) {
  */
 void destroy_heap(softheap *P) {
   if(P == NULL) return;
+  notify(SH_OP_DESTROY, P, NULL, NULL, 0);
+  begin_op(P, NULL);
 
   tree *curr = P->first, *next;
   while(curr != NULL) {
     next = curr->next;
-    destroy_node(curr->root);
-    free(curr);
+    destroy_node(curr->root, !P->intrusive);
+    release(curr);
+    STAT(trees_destroyed);
     curr = next;
   }  
 
+  // Queued nodes still in a tree were freed above; the dead ones are ours to free
+  for(size_t i = 0; i < P->pending_len; i++) {
+    node *x = P->pending[(P->pending_head + i) % P->pending_cap];
+    if(x->flags & NODE_DEAD) release(x);
+  }
+  end_op();
+
+  // Nothing will reclaim this heap's deferred frees later, so do it now
+  if(P->free_mode == SOFTHEAP_FREE_BACKGROUND) reclaim_in_background(P);
+  else softheap_reclaim(P);
+  free(P->run);
+  free(P->pending);
   free(P);
+  STAT(frees);
+}
+
+
+/****************************************** DEFERRED FREES *****************************************/
+
+/* The reclaimer thread's inbox: a chain of objects handed over by heaps
+ * in background mode, guarded by reclaim_lock. */
+static void *reclaim_head = NULL, *reclaim_tail = NULL;
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaim_ready = PTHREAD_COND_INITIALIZER;
+static pthread_once_t reclaim_once = PTHREAD_ONCE_INIT;
+
+/* Function: free_chain
+ * --------------------
+ * Free every object on a chain built by defer_free. Returns how many.
+ */
+static size_t free_chain(void *p) {
+  size_t n = 0;
+  while(p != NULL) {
+    void *next = *(void **)p;
+    free_object(p);
+    p = next;
+    n++;
+  }
+  return n;
+}
+
+/* Function: reclaimer
+ * -------------------
+ * Body of the reclaimer thread: wait for chains and free them, in bulk
+ * and off the threads using the heaps.
+ */
+static void *reclaimer(void *arg) {
+  (void)arg;
+  for(;;) {
+    pthread_mutex_lock(&reclaim_lock);
+    while(reclaim_head == NULL) pthread_cond_wait(&reclaim_ready, &reclaim_lock);
+    void *chain = reclaim_head;
+    reclaim_head = reclaim_tail = NULL;
+    pthread_mutex_unlock(&reclaim_lock);
+    free_chain(chain);
+  }
+  return NULL;
 }
 
+/* Function: start_reclaimer
+ * -------------------------
+ * Start the reclaimer thread, detached; it lives as long as the process.
+ */
+static void start_reclaimer(void) {
+  pthread_t t;
+  if(pthread_create(&t, NULL, reclaimer, NULL) != 0) error(1,0, "Cannot start the soft heap reclaimer thread");
+  pthread_detach(t);
+}
+
+/* Function: reclaim_in_background
+ * -------------------------------
+ * Hand everything P has deferred to the reclaimer thread.
+ */
+static void reclaim_in_background(softheap *P) {
+  if(P->deferred == NULL) return;
+  pthread_mutex_lock(&reclaim_lock);
+  if(reclaim_tail != NULL) *(void **)reclaim_tail = P->deferred;
+  else reclaim_head = P->deferred;
+  reclaim_tail = P->deferred_tail;
+  pthread_cond_signal(&reclaim_ready);
+  pthread_mutex_unlock(&reclaim_lock);
+  P->deferred = P->deferred_tail = NULL;
+  P->ndeferred = 0;
+}
+
+/* Function: defer_free
+ * --------------------
+ * Add object p, which is no longer in use, to P's chain of deferred frees,
+ * passing the chain to the reclaimer once it is a full batch.
+ */
+static void defer_free(softheap *P, void *p) {
+  *(void **)p = P->deferred;
+  P->deferred = p;
+  if(P->deferred_tail == NULL) P->deferred_tail = p;
+  if(++P->ndeferred >= RECLAIM_BATCH && P->free_mode == SOFTHEAP_FREE_BACKGROUND) reclaim_in_background(P);
+}
+
+/* Function: adopt_deferred
+ * ------------------------
+ * Move the deferred frees of from onto into's chain.
+ */
+static void adopt_deferred(softheap *into, softheap *from) {
+  if(from->deferred == NULL) return;
+  *(void **)from->deferred_tail = into->deferred;
+  into->deferred = from->deferred;
+  if(into->deferred_tail == NULL) into->deferred_tail = from->deferred_tail;
+  into->ndeferred += from->ndeferred;
+}
+
+/* Function: softheap_set_free_mode
+ * --------------------------------
+ * Choose where P's frees go from now on. Leaving a deferred mode reclaims
+ * whatever is still waiting.
+ */
+void softheap_set_free_mode(softheap *P, softheap_free_mode mode) {
+  if(mode == SOFTHEAP_FREE_BACKGROUND) pthread_once(&reclaim_once, start_reclaimer);
+  if(mode == SOFTHEAP_FREE_NOW) softheap_reclaim(P);
+  P->free_mode = mode;
+}
+
+/* Function: softheap_reclaim
+ * --------------------------
+ * Free everything P has deferred, on the calling thread.
+ */
+size_t softheap_reclaim(softheap *P) {
+  void *chain = P->deferred;
+  P->deferred = P->deferred_tail = NULL;
+  P->ndeferred = 0;
+  return free_chain(chain);
+}
 
 /************************************ HEAP STRUCTURE MANIPULATION *********************************/
 
@@ -246,6 +607,7 @@ void destroy_heap(softheap *P) {
  */
 static void moveList(node *src, node *dst) {
   assert(src->first != NULL);
+  STAT(movelist_calls);
   if(dst->last != NULL) dst->last->next = src->first;
   else dst->first = src->first;
   dst->last = src->last;
@@ -255,6 +617,35 @@ static void moveList(node *src, node *dst) {
   src->first = src->last = NULL;
 }
 
+/* Function: take_list
+ * -------------------
+ * Move the item list and ckey of x's left child up into x. The left child
+ * must exist and be the child of smaller ckey.
+ */
+static inline void take_list(node *x) {
+#ifdef SOFTHEAP_AUDIT
+  // Raising x's ckey corrupts every item x already holds; the stolen items keep theirs
+  if(x->nelems > 0 && x->left->ckey > x->ckey) {
+    audit_delta += x->nelems - x->ncorrupt;
+    x->ncorrupt = x->nelems;
+  }
+  x->ncorrupt += x->left->ncorrupt;
+  x->left->ncorrupt = 0;
+#endif
+  moveList(x->left, x); // concat left's list to x's to replenish x
+  x->ckey = x->left->ckey;
+}
+
+/* Function: discard
+ * -----------------
+ * Free a node that has left its tree. A node still in its heap's pending
+ * queue is only marked dead, and freed when the queue gets to it.
+ */
+static inline void discard(node *x) {
+  if(x->flags & NODE_QUEUED) x->flags |= NODE_DEAD;
+  else release(x);
+}
+
 /* Function: sift
  * --------------
  * The primary reorganizational strategy of the soft heap, called whenever
@@ -269,15 +660,16 @@ static void moveList(node *src, node *dst) {
  * of stealing from children and recursively repairing children until x is repaired or a leaf.
  */
 static void sift(node *x) {
+  STAT(sift_calls);
   while(x->nelems < x->size && !leaf(x)) {
+    STAT(sift_iterations);
     // For simplicity, switch left and right children so that left child exists & has smaller ckey
     if(x->left == NULL || (x->right != NULL && x->left->ckey > x->right->ckey)) swapLR(x);
-    moveList(x->left, x); // concat left's list to x's to replenish x
-    x->ckey = x->left->ckey;
+    take_list(x);
 
     // if left was a leaf, it can't be repaired, so destroy it
     if(leaf(x->left)) {
-      free(x->left);
+      discard(x->left);
       x->left = NULL;
     } else {
       sift(x->left);
@@ -285,22 +677,125 @@ static void sift(node *x) {
   } // Repeat as necessary until x is repaired or until x is a leaf and no more repairs are possible
 }
 
+/* Function: enqueue
+ * -----------------
+ * Add node x to the back of P's pending queue unless it is already there,
+ * doubling the ring buffer (and unwrapping it) when it is full.
+ */
+static void enqueue(softheap *P, node *x) {
+  if(x->flags & NODE_QUEUED) return;
+  if(P->pending_len == P->pending_cap) {
+    size_t cap = (P->pending_cap > 0 ? 2 * P->pending_cap : 64);
+    node **ring = malloc(cap * sizeof(node *));
+    if(ring == NULL) error(1,0, "Out of memory growing a soft heap's pending queue");
+    for(size_t i = 0; i < P->pending_len; i++)
+      ring[i] = P->pending[(P->pending_head + i) % P->pending_cap];
+    free(P->pending);
+    P->pending = ring;
+    P->pending_head = 0;
+    P->pending_cap = cap;
+  }
+  P->pending[(P->pending_head + P->pending_len++) % P->pending_cap] = x;
+  x->flags |= NODE_QUEUED;
+}
+
+/* Function: refill_step
+ * ---------------------
+ * The bounded counterpart of sift: a single iteration of sift's loop at x,
+ * which leaves x's left child empty, then a single iteration at that child,
+ * and so on down one path until the child emptied is a leaf and can be
+ * destroyed. Every node on the path ends up with a nonempty list and a valid
+ * ckey, so heap order holds throughout; nodes below x left short of their
+ * size are queued on P for later. x must not be a leaf. Returns the number
+ * of lists moved, which is at most x's rank plus one.
+ */
+static int refill_step(softheap *P, node *x) {
+  int steps = 0;
+  for(node *y = x; ; ) {
+    steps++;
+    STAT(sift_iterations);
+    if(y->left == NULL || (y->right != NULL && y->left->ckey > y->right->ckey)) swapLR(y);
+    take_list(y);
+
+    node *child = y->left;
+    bool done = leaf(child);
+    if(done) {
+      discard(child);
+      y->left = NULL;
+    }
+    if(y != x && !leaf(y) && y->nelems < y->size) enqueue(P, y);
+    if(done) return steps;
+    y = child;
+  }
+}
+
+/* Function: refill_now
+ * --------------------
+ * Give the empty non-leaf node x a list with one refill_step and queue
+ * whatever it still lacks. Used for nodes that must have a ckey at once.
+ */
+static void refill_now(softheap *P, node *x) {
+  STAT(sift_calls);
+  refill_step(P, x);
+  if(!leaf(x) && x->nelems < x->size) enqueue(P, x);
+}
+
+static void update_suffix_min(tree *T);
+
+/* Function: run_pending
+ * ---------------------
+ * Spend up to budget list moves refilling the nodes at the front of P's
+ * pending queue, releasing dead nodes and dropping nodes that no longer
+ * need work (full, or now leaves) along the way. A node whose refill is
+ * cut short stays at the front. Refilling a root changes its ckey, so if
+ * any work was done the sufmin pointers of the whole rootlist are redone.
+ */
+static void run_pending(softheap *P, int budget) {
+  bool worked = false;
+  while(P->pending_len > 0) {
+    node *x = P->pending[P->pending_head];
+    if(!(x->flags & NODE_DEAD)) {
+      while(budget > 0 && !leaf(x) && x->nelems < x->size) {
+        budget -= refill_step(P, x);
+        worked = true;
+      }
+      if(!leaf(x) && x->nelems < x->size) break; // out of budget
+    }
+
+    P->pending_head = (P->pending_head + 1) % P->pending_cap;
+    P->pending_len--;
+    x->flags &= ~NODE_QUEUED;
+    if(x->flags & NODE_DEAD) release(x);
+  }
+
+  if(worked && P->first != NULL) {
+    tree *last = P->first;
+    while(last->next != NULL) last = last->next;
+    update_suffix_min(last);
+  }
+}
+
 /* Function: combine
  * -----------------
  * Another important restructuring operation, used whenever we merge two trees of equal rank.
  * Creates a new node z with children x and y and rank 1 + rank(x), sets its size parameter,
  * and then fills its list by sifting through its children. 
  */
-static node *combine(node *x, node *y, int r) {
+static node *combine(softheap *Q, node *x, node *y, int r) {
   node *z = malloc(sizeof(node));
+  STAT(allocs);
+  STAT(combine_calls);
   z->left = x;
   z->right = y;
   z->rank = x->rank + 1;
   z->nelems = 0;
   z->first = z->last = NULL;
+  z->flags = 0;
+  AUDIT(z->ncorrupt = 0);
 
   z->size = get_next_size(z->rank, x->size, r);
-  sift(z);
+  if(Q->steps > 0) refill_now(Q, z);
+  else sift(z);
   return z;
 }
 
@@ -347,6 +842,7 @@ static void remove_tree(softheap *outof_heap, tree *removed) {
  */
 static void update_suffix_min(tree *T) {
   while(T != NULL) {
+    STAT(sufmin_steps);
     if(T->next == NULL || T->root->ckey <= T->next->sufmin->root->ckey) T->sufmin = T;
     else T->sufmin = T->next->sufmin;
     T = T->prev;
@@ -395,11 +891,12 @@ static void repeated_combine(softheap *Q, int smaller_rank, int r) {
     } else if(!three) { // exactly two trees of this rank
       // combine them to make a carry, then delete curr->next. 
       // carry may need to be merged with its next tree, so do not advance curr.
-      curr->root = combine(curr->root, curr->next->root, r);
+      curr->root = combine(Q, curr->root, curr->next->root, r);
       curr->rank = curr->root->rank;
       tree *tofree = curr->next;
       remove_tree(Q, curr->next); // will change what curr->next points to
-      free(tofree);
+      release(tofree);
+      STAT(trees_destroyed);
     } else { // exactly three trees of this rank
       // skip the first so that we can combine the second and third to form a carry
       curr = curr->next;
@@ -410,71 +907,238 @@ static void repeated_combine(softheap *Q, int smaller_rank, int r) {
   update_suffix_min(curr); // this is final tree affected by merge, so update sufmin backwds from here
 }
 
-/* Function: extract_elem
- * ----------------------
- * Remove the first element from the item list of node x and return it.
+/* Function: pop_cell
+ * ------------------
+ * Remove the first cell from the item list of node x and return it.
  * To reflect this change, decrement x's nelems counter, change the
- * element it points to as the first item, rewire the prev pointer
- * of the new first element to NULL (if it exists), and reset the
- * last pointer of x if the new list has one or no items.
+ * cell it points to as the first item, and reset the last pointer
+ * of x if the new list has one or no items. The caller frees the
+ * cell, unless it is a client's hook.
  */
-static int extract_elem(node *x) {
+static cell *pop_cell(node *x) {
   assert(x->first != NULL);
-  cell *todelete = x->first;
-  int result = todelete->elem;
+  cell *c = x->first;
 
-  x->first = todelete->next;
+  x->first = c->next;
   if(x->first == NULL) x->last = NULL;
   else if(x->first->next == NULL) x->last = x->first;
 
-  free(todelete);
   x->nelems--;
-  return result;
+  return c;
 }
 
 /*************************************** CLIENT-SIDE OPERATIONS ************************************/
 
+static softheap *meld_heaps(softheap *P, softheap *Q);
+static void retire_heap(softheap *into, softheap *from);
+
 /* Function: empty
  * ---------------
- * Returns true if and only if P contains no trees,
- * i.e. it contains no elements.
+ * Returns true if and only if P contains no trees and has no
+ * buffered run, i.e. it contains no elements.
  */
 bool empty(softheap *P) {
-  return P->first == NULL;
+  return P->first == NULL && P->nrun == 0;
 }
 
-/* Function: insert
- * ----------------
- * Put a new element into soft heap P. If P is nonempty, this can be accomplished 
+/* Function: build_node
+ * --------------------
+ * Build a subtree of rank rank from the m keys at keys, which are sorted
+ * ascending, with m at most 2^rank. The root takes the smallest keys, as
+ * many as its size calls for, so its ckey is the largest of them; above
+ * rank r a node holds more than one key, and the keys below that ckey are
+ * corrupted (and reported to the audit). The rest are split between two
+ * subtrees of rank - 1, whose keys are all at least that ckey, so the
+ * subtree is heap-ordered. sizes holds the node size for each rank.
+ */
+static node *build_node(const int *keys, int m, int rank, const int *sizes) {
+  if(m == 0) return NULL;
+  node *x = malloc(sizeof(node));
+  STAT(allocs);
+  x->rank = rank;
+  x->size = sizes[rank];
+  x->flags = 0;
+
+  int take = (m < x->size ? m : x->size);
+  x->first = x->last = NULL;
+  for(int i = 0; i < take; i++) {
+    x->last = addcell(keys[i], x->last);
+    if(x->first == NULL) x->first = x->last;
+  }
+  x->nelems = take;
+  x->ckey = keys[take - 1];
+#ifdef SOFTHEAP_AUDIT
+  x->ncorrupt = 0;
+  while(x->ncorrupt < take && keys[x->ncorrupt] < x->ckey) x->ncorrupt++;
+  audit_delta += x->ncorrupt;
+#endif
+
+  int rest = m - take, half = (rest + 1) / 2;
+  x->left = build_node(keys + take, half, rank - 1, sizes);
+  x->right = build_node(keys + take + half, rest - half, rank - 1, sizes);
+  return x;
+}
+
+/* Function: flush_run
+ * -------------------
+ * Turn P's buffered run into trees, one per power of two in its length,
+ * and meld each into P. A descending run is reversed first.
+ */
+static void flush_run(softheap *P) {
+  int m = P->nrun;
+  if(m == 0) return;
+  P->nrun = 0;
+  if(P->run_dir < 0)
+    for(int i = 0, j = m - 1; i < j; i++, j--) {
+      int tmp = P->run[i];
+      P->run[i] = P->run[j];
+      P->run[j] = tmp;
+    }
+
+  int sizes[RUN_MAX_RANK + 1];
+  sizes[0] = 1;
+  for(int k = 1; k <= RUN_MAX_RANK; k++) sizes[k] = get_next_size(k, sizes[k - 1], P->r);
+
+  const int *keys = P->run;
+  for(int k = RUN_MAX_RANK; k >= 0; k--) {
+    if(!(m & (1 << k))) continue;
+    softheap *h = new_heap(P->epsilon);
+    tree *T = malloc(sizeof(tree));
+    STAT(allocs);
+    STAT(trees_created);
+    T->root = build_node(keys, 1 << k, k, sizes);
+    T->prev = T->next = NULL;
+    T->rank = k;
+    T->sufmin = T;
+    if(P->rank < k) { // meld_heaps keeps the heap of higher rank, and that must be P
+      h->first = P->first;
+      h->rank = P->rank;
+      P->first = T;
+      P->rank = k;
+    } else {
+      h->first = T;
+      h->rank = k;
+    }
+    AUDIT(h->audit.inserts = 1 << k);
+    meld_heaps(P, h);
+    keys += 1 << k;
+  }
+}
+
+/* Function: run_insert
+ * --------------------
+ * Track the monotone run that the inserts into P form, and buffer elem if
+ * it continues a run already RUN_MIN long. A key that breaks the run
+ * flushes the buffer and starts a new run. Returns true if elem was
+ * buffered, and false if it should be inserted normally.
+ */
+static bool run_insert(softheap *P, int elem) {
+  int d = (elem > P->run_last) - (elem < P->run_last);
+  if(P->run_len == 0) P->run_len = 1;
+  else if(P->run_len == 1) {
+    P->run_dir = (d >= 0 ? 1 : -1);
+    P->run_len = 2;
+  } else if(d == 0 || d == P->run_dir) P->run_len++;
+  else {
+    flush_run(P);
+    P->run_len = 1;
+  }
+  P->run_last = elem;
+  if(P->run_len <= RUN_MIN) return false;
+
+  if(P->run == NULL) {
+    P->run = malloc(RUN_MAX * sizeof(int));
+    if(P->run == NULL) return false;
+  }
+  P->run[P->nrun++] = elem;
+  if(P->nrun == RUN_MAX) flush_run(P);
+  return true;
+}
+
+/* Function: softheap_detect_runs
+ * ------------------------------
+ * Turn P's handling of monotone runs of inserts on or off.
+ */
+void softheap_detect_runs(softheap *P, bool on) {
+  begin_op(P, NULL);
+  flush_run(P);
+  end_op();
+  AUDIT(audit_settle(P, "detect_runs"));
+  P->detect_runs = on && !P->intrusive;
+  P->run_len = 0;
+}
+
+/* Function: insert_cell
+ * ---------------------
+ * Put a new cell into soft heap P. If P is nonempty, this can be accomplished
  * by creating a new soft heap for the parameter and melding it into P. However,
  * if P is empty, this strategy will destroy P and leave the client with a freed
- * pointer, so instead we directly insert a new tree containing elem into P's rootlist
+ * pointer, so instead we directly insert a new tree containing c into P's rootlist
  * and set its rank to 0.
  */
-void insert(softheap *P, int elem) {
+static void insert_cell(softheap *P, cell *c) {
   if(empty(P)) { 
-    P->first = maketree(elem);
+    P->first = maketree(c);
     P->rank = 0;
-  } else meld(P, makeheap(elem, P->epsilon));
+    AUDIT(P->audit.inserts++);
+  } else {
+    softheap *s = singleton_heap(c, P->epsilon);
+    s->intrusive = P->intrusive;
+    meld_heaps(P, s);
+  }
+  if(P->steps > 0) run_pending(P, P->steps);
 }
 
-/* Function: meld
- * --------------
+/* Function: insert
+ * ----------------
+ * Put a new element into soft heap P, in a fresh cell or, if it continues
+ * a run, in P's run buffer.
+ */
+void insert(softheap *P, int elem) {
+  if(P->intrusive) error(1,0, "Tried to insert an int into an intrusive soft heap");
+  begin_op(P, NULL);
+  if(!(P->detect_runs && run_insert(P, elem))) insert_cell(P, addcell(elem, NULL));
+  end_op();
+  AUDIT(audit_settle(P, "insert"));
+  notify(SH_OP_INSERT, P, NULL, P, elem);
+}
+
+/* Function: insert_hook
+ * ---------------------
+ * Put the client's hook h into the intrusive soft heap P as its own cell.
+ */
+void insert_hook(softheap *P, softheap_hook *h) {
+  if(!P->intrusive) error(1,0, "Tried to insert a hook into a soft heap that is not intrusive");
+  begin_op(P, NULL);
+  h->next = NULL;
+  insert_cell(P, h);
+  end_op();
+  AUDIT(audit_settle(P, "insert"));
+  notify(SH_OP_INSERT, P, NULL, P, h->key);
+}
+
+/* Function: meld_heaps
+ * --------------------
  * Combine all elements of soft heaps P and Q into a new conglomerate heap,
  * destructively modifying P and Q. Return the result. This is implemented
  * by executing a merge_into to push all elements from the lower-rank heap
  * into the higher-rank heap, then calling repeated-combine to combine
  * all trees of duplicate rank.
  */
-softheap *meld(softheap *P, softheap *Q) {
+static softheap *meld_heaps(softheap *P, softheap *Q) {
   // Do not allow melding if the soft heaps don't seem to have the same error parameter.
   double max_eps = max(P->epsilon, Q->epsilon), min_eps = min(P->epsilon, Q->epsilon);
   double eps_off = 1 - min_eps/max_eps; 
   if(eps_off > 0.001) error(1,0, "Tried to combine soft heaps with different epsilons");
+  if(P->intrusive != Q->intrusive) error(1,0, "Tried to combine an intrusive soft heap with an ordinary one");
+
+  // The result is bounded if either heap is and defers frees if either does
+  P->steps = Q->steps = (P->steps > Q->steps ? P->steps : Q->steps);
+  P->free_mode = Q->free_mode = (P->free_mode > Q->free_mode ? P->free_mode : Q->free_mode);
 
   // If both softheaps empty, just destroy one and return the other
   if(empty(P) && empty(Q)) {
-    free(P);
+    retire_heap(Q, P);
     return Q;
   }
 
@@ -482,18 +1146,60 @@ softheap *meld(softheap *P, softheap *Q) {
   if(P->rank >= Q->rank) { // meld Q into P
     merge_into(Q, P);
     repeated_combine(P, Q->rank, P->r);
-    free(Q);
+    retire_heap(P, Q);
     result = P;
   } else { // meld P into Q
     merge_into(P, Q);
     repeated_combine(Q, P->rank, Q->r);
-    free(P);
+    retire_heap(Q, P);
     result = Q;
   }
 
   return result;
 }
 
+/* Function: retire_heap
+ * ---------------------
+ * Free the heap struct of from, whose trees now belong to into, after
+ * handing into its pending queue and audit record.
+ */
+static void retire_heap(softheap *into, softheap *from) {
+  for(size_t i = 0; i < from->pending_len; i++) {
+    node *x = from->pending[(from->pending_head + i) % from->pending_cap];
+    x->flags &= ~NODE_QUEUED;
+    enqueue(into, x);
+  }
+  free(from->pending);
+  free(from->run);
+  adopt_deferred(into, from);
+  AUDIT(audit_merge(&into->audit, &from->audit));
+  free(from);
+  STAT(frees);
+}
+
+/* Function: meld
+ * --------------
+ * Public meld: combine P and Q as in meld_heaps and report it to the observer.
+ */
+softheap *meld(softheap *P, softheap *Q) {
+  begin_op(P, Q);
+  flush_run(P);
+  flush_run(Q);
+  // The result detects runs only if both heaps did. This is left out of
+  // meld_heaps, whose internal melds of singletons and run trees (made by
+  // new_heap, with detection off) must not turn it off for P.
+  P->detect_runs = Q->detect_runs = (P->detect_runs && Q->detect_runs);
+  P->run_len = Q->run_len = 0;
+  softheap *result = meld_heaps(P, Q);
+  // The heap deferring was pointed at may just have been retired
+  deferring = (result->free_mode != SOFTHEAP_FREE_NOW ? result : NULL);
+  if(result->steps > 0) run_pending(result, result->steps);
+  end_op();
+  AUDIT(audit_settle(result, "meld"));
+  notify(SH_OP_MELD, P, Q, result, 0);
+  return result;
+}
+
 /* Function: extract_min
  * ----------------------
  * Extract and return an element from the node of minimum ckey 
@@ -504,45 +1210,466 @@ int extract_min(softheap *P) {
   return extract_min_with_ckey(P, &filler);
 }
 
-/* Function: extract_min_with_ckey
- * -------------------------------
- * Extract and return an element from the node of minimum ckey
+/* Function: extract_cell
+ * ----------------------
+ * Remove and return a cell from the node of minimum ckey
  * in the soft heap, and store that ckey in the space pointed to
  * by ckey_into. The node of minimum ckey is the root of some
  * tree in the heap, by the heap property invariant. This tree
  * is pointed to by the sufmin pointer of the first tree in the rootlist.
- * After removing that element from the root, we check whether it is now
+ * After removing that cell from the root, we check whether it is now
  * size-deficient. If so, we sift it (if it has children), ignore it
  * (if it has no children but is not empty), or destroy the tree 
  * it roots (if it has no children and is empty). Once this is done, we
  * update the sufmin pointers of T and all its predecessors
  * (or just T's predecessors if T was removed).
  */
-int extract_min_with_ckey(softheap *P, int *ckey_into) {
-  if(empty(P)) error(1,0, "Tried to extract an element from an empty soft heap");
+static cell *extract_cell(softheap *P, int *ckey_into) {
+  flush_run(P);
 
   tree *T = P->first->sufmin; // tree with lowest root ckey
   node *x = T->root;
-  int e = extract_elem(x);
+  cell *c = pop_cell(x);
   *ckey_into = x->ckey;
+#ifdef SOFTHEAP_AUDIT
+  softheap_audit *a = &P->audit;
+  a->extractions++;
+  a->last_corrupted = (c->key < x->ckey);
+  a->last_inflation = (long)x->ckey - c->key;
+  if(a->last_corrupted) {
+    x->ncorrupt--;
+    a->corrupted--;
+    a->corrupted_extractions++;
+    a->total_inflation += a->last_inflation;
+    if(a->last_inflation > a->max_inflation) a->max_inflation = a->last_inflation;
+  }
+#endif
 
   if(x->nelems <= x->size / 2) { // x is deficient; rescue it if possible
     if(!leaf(x)) {
-      sift(x);
-      update_suffix_min(T);
+      if(P->steps == 0) { // repair x completely
+        sift(x);
+        update_suffix_min(T);
+      } else if(x->nelems == 0) { // a bounded heap refills x only as far as it must
+        refill_now(P, x);
+        update_suffix_min(T);
+      } else enqueue(P, x);
     } else if(x->nelems == 0) { // x is a leaf and empty; it must be destroyed
-      free(x);
+      discard(x);
       remove_tree(P, T);
 
       if(T->next == NULL) { // we removed the highest-ranked tree; reset heap rank and clean up
-        if(T->prev == NULL) P->rank = -1; // Heap now empty. Rank -1 is sentinel for future melds
-        else P->rank = T->prev->rank;
+        if(T->prev == NULL) { // Heap now empty. Rank -1 is sentinel for future melds
+          P->rank = -1;
+          free(P->run); // so that an emptied heap holds no memory but its struct
+          P->run = NULL;
+        } else P->rank = T->prev->rank;
       }
 
       if(T->prev != NULL) update_suffix_min(T->prev);
-      free(T);
+      release(T);
+      STAT(trees_destroyed);
     }
   }
 
+  if(P->steps > 0) run_pending(P, P->steps);
+  return c;
+}
+
+/* Function: extract_min_with_ckey
+ * -------------------------------
+ * Extract and return an element from the node of minimum ckey
+ * in the soft heap (see extract_cell), and store that ckey in the
+ * space pointed to by ckey_into.
+ */
+int extract_min_with_ckey(softheap *P, int *ckey_into) {
+  if(empty(P)) error(1,0, "Tried to extract an element from an empty soft heap");
+  if(P->intrusive) error(1,0, "Tried to extract an int from an intrusive soft heap");
+  begin_op(P, NULL);
+  cell *c = extract_cell(P, ckey_into);
+  int e = c->key;
+  release(c);
+  end_op();
+  AUDIT(audit_settle(P, "extract"));
+  notify(SH_OP_EXTRACT, P, NULL, P, e);
   return e;
 }
+
+/* Function: extract_min_hook
+ * --------------------------
+ * Extract the client hook from the node of minimum ckey in the
+ * intrusive soft heap P, and store that ckey in the space pointed
+ * to by ckey_into unless it is NULL.
+ */
+softheap_hook *extract_min_hook(softheap *P, int *ckey_into) {
+  if(empty(P)) error(1,0, "Tried to extract an element from an empty soft heap");
+  if(!P->intrusive) error(1,0, "Tried to extract a hook from a soft heap that is not intrusive");
+  int ckey;
+  begin_op(P, NULL);
+  softheap_hook *h = extract_cell(P, &ckey);
+  end_op();
+  AUDIT(audit_settle(P, "extract"));
+  notify(SH_OP_EXTRACT, P, NULL, P, h->key);
+  if(ckey_into != NULL) *ckey_into = ckey;
+  return h;
+}
+
+/* Function: extract_min_ex
+ * ------------------------
+ * Extract an element as extract_min_with_ckey does and describe it in
+ * into. Items are their own keys, so corruption is a plain comparison
+ * with the ckey.
+ */
+int extract_min_ex(softheap *P, softheap_item *into) {
+  into->key = extract_min_with_ckey(P, &into->ckey);
+  into->corrupted = (into->ckey != into->key);
+  return into->key;
+}
+
+/****************************************** OPERATION COUNTERS ***********************************/
+
+/* Function: softheap_stats_enabled
+ * --------------------------------
+ * Report whether this build maintains operation counters.
+ */
+bool softheap_stats_enabled(void) {
+#ifdef SOFTHEAP_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Function: softheap_get_stats
+ * ----------------------------
+ * Copy out the calling thread's counters (all zero if counting is compiled out).
+ */
+void softheap_get_stats(softheap_stats *into) {
+#ifdef SOFTHEAP_STATS
+  *into = stats;
+#else
+  memset(into, 0, sizeof(*into));
+#endif
+}
+
+/* Function: softheap_reset_stats
+ * ------------------------------
+ * Zero the calling thread's counters.
+ */
+void softheap_reset_stats(void) {
+#ifdef SOFTHEAP_STATS
+  memset(&stats, 0, sizeof(stats));
+#endif
+}
+
+/********************************************* OBSERVATION ****************************************/
+
+/* Function: softheap_set_observer
+ * -------------------------------
+ * Install (or with NULL, remove) the process-wide operation observer.
+ */
+void softheap_set_observer(softheap_observer obs, void *ctx) {
+  observer = obs;
+  observer_ctx = ctx;
+}
+
+/* Function: softheap_epsilon
+ * --------------------------
+ * Return the error parameter P was created with.
+ */
+double softheap_epsilon(softheap *P) {
+  return P->epsilon;
+}
+
+/******************************************* INTROSPECTION ****************************************/
+
+/* Function: list_bucket
+ * ---------------------
+ * Return the softheap_shape list-length bucket of a node with nelems
+ * items and the given size, comparing in integers to avoid rounding.
+ */
+static int list_bucket(long nelems, long size) {
+  if(nelems == 0) return 0;
+  if(2 * nelems < size) return 1;
+  if(nelems < size) return 2;
+  if(2 * nelems < 3 * size) return 3;
+  if(nelems < 2 * size) return 4;
+  if(nelems < 3 * size) return 5;
+  if(nelems < 4 * size) return 6;
+  return 7;
+}
+
+/* Function: shape_node
+ * --------------------
+ * Add node x and its subtree to the shape statistics, without modifying
+ * anything in the heap.
+ */
+static void shape_node(const node *x, softheap_shape *into) {
+  if(x == NULL) return;
+  int k = (x->rank < SOFTHEAP_MAX_RANK ? x->rank : SOFTHEAP_MAX_RANK - 1);
+  bool is_leaf = (x->left == NULL && x->right == NULL);
+
+  into->nnodes++;
+  into->nodes_by_rank[k]++;
+  into->items_by_rank[k] += x->nelems;
+  into->size_by_rank[k] = x->size;
+  into->list_vs_size[list_bucket(x->nelems, x->size)]++;
+  into->nitems += x->nelems;
+  if(is_leaf) into->nleaves++;
+  if(x->nelems < x->size) {
+    if(is_leaf) into->deficient_leaves++;
+    else into->deficient_internal++;
+  }
+
+  for(const cell *c = x->first; c != NULL; c = c->next) {
+    long inflation = (long)x->ckey - c->key;
+    if(inflation > 0) into->corrupted++;
+    if(inflation > into->max_inflation) into->max_inflation = inflation;
+    if(inflation > into->inflation_by_rank[k]) into->inflation_by_rank[k] = inflation;
+  }
+
+  shape_node(x->left, into);
+  shape_node(x->right, into);
+}
+
+/* Function: softheap_get_shape
+ * ----------------------------
+ * Walk the rootlist and every tree of P, collecting structural statistics.
+ * Keys still in the run buffer are counted as uncorrupted rank-0 items in
+ * no node; flushing them here would change the heap.
+ */
+void softheap_get_shape(softheap *P, softheap_shape *into) {
+  memset(into, 0, sizeof(*into));
+  into->epsilon = P->epsilon;
+  into->r = P->r;
+  into->rank = P->rank;
+
+  for(const tree *T = P->first; T != NULL; T = T->next) {
+    into->ntrees++;
+    into->trees_by_rank[T->rank < SOFTHEAP_MAX_RANK ? T->rank : SOFTHEAP_MAX_RANK - 1]++;
+    shape_node(T->root, into);
+  }
+  into->nitems += P->nrun;
+  into->items_by_rank[0] += P->nrun;
+}
+
+/********************************************** COMPACTION ****************************************/
+
+/* Function: arena_init
+ * --------------------
+ * Reserve the arena's address range, aligned to a chunk, with no access
+ * and no memory behind it, and publish it by storing arena_reserved last.
+ * If that fails, nothing is kept and arena_reserved stays 0, which tells
+ * arena_chunk to send every later compaction straight to malloc.
+ */
+static void arena_init(void) {
+  size_t nchunks = ARENA_RESERVE / ARENA_CHUNK;
+  char *p = mmap(NULL, ARENA_RESERVE + ARENA_CHUNK, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  arena_live = calloc(nchunks, sizeof(long));
+  arena_free_chunks = malloc(nchunks * sizeof(int));
+  if(p == MAP_FAILED || arena_live == NULL || arena_free_chunks == NULL) {
+    if(p != MAP_FAILED) munmap(p, ARENA_RESERVE + ARENA_CHUNK);
+    free(arena_live);
+    free(arena_free_chunks);
+    arena_live = NULL;
+    arena_free_chunks = NULL;
+    return;
+  }
+
+  arena_base = (char *)(((uintptr_t)p + ARENA_CHUNK - 1) & ~(uintptr_t)(ARENA_CHUNK - 1));
+  __atomic_store_n(&arena_reserved, ARENA_RESERVE, __ATOMIC_RELEASE);
+}
+
+/* Function: arena_chunk
+ * ---------------------
+ * Make a chunk of the arena usable and point cursor a at it. Returns false
+ * if there is no arena, the reservation is used up or the memory cannot
+ * be had.
+ */
+static bool arena_chunk(arena_cursor *a) {
+  if(arena_reserved == 0) return false; // arena_init failed; runs after it, so no race
+  pthread_mutex_lock(&arena_lock);
+  int idx = -1;
+  if(arena_nfree > 0) idx = arena_free_chunks[--arena_nfree];
+  else if((size_t)arena_next < arena_reserved / ARENA_CHUNK) idx = arena_next++;
+  pthread_mutex_unlock(&arena_lock);
+  if(idx < 0) return false;
+
+  char *chunk = arena_base + ((size_t)idx << ARENA_CHUNK_SHIFT);
+  if(mprotect(chunk, ARENA_CHUNK, PROT_READ | PROT_WRITE) != 0) {
+    pthread_mutex_lock(&arena_lock);
+    arena_free_chunks[arena_nfree++] = idx;
+    pthread_mutex_unlock(&arena_lock);
+    return false;
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(chunk, ARENA_CHUNK, MADV_HUGEPAGE);
+#endif
+  a->next = chunk;
+  a->end = chunk + ARENA_CHUNK;
+  a->live = &arena_live[idx];
+  return true;
+}
+
+/* Function: arena_alloc
+ * ---------------------
+ * Place an object of the given size at cursor a, moving to a fresh chunk
+ * when the current one is full, or falling back to malloc if there are
+ * no chunks left.
+ */
+static void *arena_alloc(arena_cursor *a, size_t size) {
+  STAT(allocs);
+  if((size_t)(a->end - a->next) < size && !arena_chunk(a)) {
+    a->next = a->end = NULL;
+    void *p = malloc(size);
+    if(p == NULL) error(1,0, "Out of memory compacting a soft heap");
+    return p;
+  }
+  void *p = a->next;
+  a->next += size;
+  __atomic_add_fetch(a->live, 1, __ATOMIC_RELAXED);
+  return p;
+}
+
+/* Function: arena_release
+ * -----------------------
+ * Free an object living in the arena. Once its chunk is empty, the pages
+ * are dropped by mapping fresh inaccessible memory over them, and the chunk
+ * can be reused by a later compaction. Objects are never freed while their
+ * chunk is still being filled, so an empty chunk is never the current one.
+ */
+static void arena_release(void *p) {
+  size_t idx = ((char *)p - arena_base) >> ARENA_CHUNK_SHIFT;
+  if(__atomic_sub_fetch(&arena_live[idx], 1, __ATOMIC_ACQ_REL) != 0) return;
+
+  char *chunk = arena_base + (idx << ARENA_CHUNK_SHIFT);
+  mmap(chunk, ARENA_CHUNK, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  pthread_mutex_lock(&arena_lock);
+  arena_free_chunks[arena_nfree++] = idx;
+  pthread_mutex_unlock(&arena_lock);
+}
+
+/* Function: compact_node
+ * ----------------------
+ * Move node x, then its item list (unless its cells are client hooks, which
+ * stay where they are), then its left and right subtrees into the arena,
+ * freeing the originals as it goes. Returns the new copy of x.
+ */
+static node *compact_node(node *x, arena_cursor *a, bool move_cells) {
+  if(x == NULL) return NULL;
+  node *y = arena_alloc(a, sizeof(node));
+  *y = *x;
+  release(x);
+
+  if(move_cells) {
+    cell **link = &y->first;
+    y->last = NULL;
+    for(cell *c = *link, *next; c != NULL; c = next) {
+      next = c->next;
+      cell *d = arena_alloc(a, sizeof(cell));
+      d->key = c->key;
+      release(c);
+      *link = y->last = d;
+      link = &d->next;
+    }
+    *link = NULL;
+  }
+
+  y->left = compact_node(y->left, a, move_cells);
+  y->right = compact_node(y->right, a, move_cells);
+  return y;
+}
+
+/* Function: softheap_compact
+ * --------------------------
+ * Move every tree of P into fresh arena memory, each tree followed by its
+ * nodes in DFS order with every node's list right behind it, so that the
+ * sifts of later extractions walk memory mostly forwards. Trees are moved
+ * one at a time, so at most one tree is ever held twice. Afterwards the
+ * memory malloc was holding for the freed originals is returned to the OS.
+ */
+void softheap_compact(softheap *P) {
+  run_pending(P, INT_MAX); // so that no queued or dead node can be left behind
+  AUDIT(audit_settle(P, "compact"));
+  softheap_reclaim(P);
+  if(P->first == NULL) return; // buffered run keys are not in trees and stay put
+  pthread_once(&arena_once, arena_init);
+
+  arena_cursor a = { NULL, NULL, NULL };
+  tree *prev = NULL;
+  for(tree *T = P->first, *next; T != NULL; T = next) {
+    next = T->next;
+    tree *U = arena_alloc(&a, sizeof(tree));
+    *U = *T;
+    release(T);
+
+    U->prev = prev;
+    U->next = NULL;
+    if(prev != NULL) prev->next = U;
+    else P->first = U;
+    U->root = compact_node(U->root, &a, !P->intrusive);
+    prev = U;
+  }
+  update_suffix_min(prev); // sufmin pointers still point at the old trees
+
+  malloc_trim(0);
+}
+
+/********************************************* AUDITING *****************************************/
+
+/* Function: softheap_audit_enabled
+ * --------------------------------
+ * Report whether this build audits corruption.
+ */
+bool softheap_audit_enabled(void) {
+#ifdef SOFTHEAP_AUDIT
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* Function: softheap_get_audit
+ * ----------------------------
+ * Copy out P's audit record (all zero if auditing is compiled out).
+ */
+void softheap_get_audit(softheap *P, softheap_audit *into) {
+#ifdef SOFTHEAP_AUDIT
+  *into = P->audit;
+#else
+  memset(into, 0, sizeof(*into));
+#endif
+}
+
+#ifdef SOFTHEAP_AUDIT
+/* Function: audit_settle
+ * ----------------------
+ * Add the items corrupted by the sifts of the operation op that just ran
+ * on P to P's count, and check the soft heap's guarantee that at most
+ * epsilon * n items are corrupted after n insertions.
+ */
+static void audit_settle(softheap *P, const char *op) {
+  softheap_audit *a = &P->audit;
+  a->corrupted += audit_delta;
+  audit_delta = 0;
+  if(a->corrupted > a->max_corrupted) a->max_corrupted = a->corrupted;
+  if(a->corrupted > P->epsilon * a->inserts)
+    error(1,0, "Soft heap audit: %ld corrupted items after %s exceeds epsilon * n = %g * %ld",
+          a->corrupted, op, P->epsilon, a->inserts);
+}
+
+/* Function: audit_merge
+ * ---------------------
+ * Fold the audit record of a heap melded away into that of the result.
+ */
+static void audit_merge(softheap_audit *into, const softheap_audit *from) {
+  into->inserts += from->inserts;
+  into->corrupted += from->corrupted;
+  if(from->max_corrupted > into->max_corrupted) into->max_corrupted = from->max_corrupted;
+  into->extractions += from->extractions;
+  into->corrupted_extractions += from->corrupted_extractions;
+  into->total_inflation += from->total_inflation;
+  if(from->max_inflation > into->max_inflation) into->max_inflation = from->max_inflation;
+}
+#endif
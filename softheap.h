@@ -15,6 +15,7 @@
 #define SOFTHEAP_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Opaque type defining the soft heap data structure. */
 typedef struct SOFTHEAP softheap;
@@ -35,6 +36,35 @@ softheap *makeheap(int elem, double epsilon);
  */
 softheap *makeheap_empty(double epsilon);
 
+/**
+ * Function: makeheap_bounded
+ * --------------------------
+ * Returns an empty soft heap that trades throughput for latency: instead
+ * of fully repairing the nodes an operation leaves short of items, which
+ * can cascade through a whole tree, it repairs each just enough to keep a
+ * valid ckey (one list move per level, O(log n)) and queues the rest. Each
+ * operation then works off at most steps list moves from the queue. The
+ * heap behaves as a soft heap with parameter epsilon throughout; melding
+ * with an ordinary heap gives a bounded one.
+ */
+softheap *makeheap_bounded(double epsilon, int steps);
+
+/**
+ * Function: softheap_detect_runs
+ * ------------------------------
+ * Turns P's fast path for presorted input on or off. It starts off, and
+ * intrusive heaps cannot have it. While it is on, once enough consecutive
+ * inserts have been in ascending or descending order, further keys of the
+ * run are buffered and later built directly into heap-ordered trees
+ * instead of going through a meld each. Nodes of those trees above rank r
+ * hold several keys, all but the largest of them corrupted, as after any
+ * sift. The buffer (at most 4096 keys) is flushed into the heap when the
+ * run ends or the buffer fills, and by the next extract or meld. Turning
+ * the fast path on changes which items get corrupted, and on a bounded
+ * heap a flush is a burst of unbounded work.
+ */
+void softheap_detect_runs(softheap *P, bool on);
+
 /**
  * Function: destroy_heap
  * ----------------------
@@ -92,4 +122,258 @@ int extract_min(softheap *P);
  */
 int extract_min_with_ckey(softheap *P, int *ckey_into);
 
+/* An extracted item: its original key, the ckey it was carried with, and
+ * whether the two differ. */
+typedef struct {
+  int key;
+  int ckey;
+  bool corrupted;
+} softheap_item;
+
+/**
+ * Function: extract_min_ex
+ * ------------------------
+ * Extracts an element from soft heap P like extract_min_with_ckey, and
+ * fills in the struct pointed to by into with its key, its ckey and
+ * whether it was corrupted (ckey != key), so that callers which must be
+ * exact can route corrupted items to a repair path. The key is the item
+ * itself, so the check costs one comparison. Returns the key.
+ */
+int extract_min_ex(softheap *P, softheap_item *into);
+
+/* The list hook of an intrusive soft heap (see makeheap_intrusive). Clients
+ * embed one in each object they want to queue, set key, and get the object
+ * back from the hook with softheap_entry, as with the Linux kernel's
+ * list_head. The heap owns next while the hook is queued. */
+typedef struct softheap_hook {
+  int key;
+  struct softheap_hook *next;
+} softheap_hook;
+
+/* The object of type type whose member member is the hook ptr. */
+#define softheap_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/**
+ * Function: makeheap_intrusive
+ * ----------------------------
+ * Returns an empty intrusive soft heap. Its items are hooks embedded in the
+ * client's own objects, which insert_hook links into the heap's lists as
+ * they are, so inserting allocates nothing for the item. The heap never
+ * frees a hook: destroying it, or compacting it, leaves the objects alone.
+ * An intrusive heap melds only with other intrusive heaps, and takes only
+ * insert_hook and extract_min_hook, not the int operations.
+ */
+softheap *makeheap_intrusive(double epsilon);
+
+/**
+ * Function: insert_hook
+ * ---------------------
+ * Inserts the object whose hook is h, with priority h->key, into the
+ * intrusive soft heap P. The hook must not be touched until it has been
+ * extracted again (or the heap destroyed).
+ */
+void insert_hook(softheap *P, softheap_hook *h);
+
+/**
+ * Function: extract_min_hook
+ * --------------------------
+ * Extracts an item from the intrusive soft heap P as extract_min_with_ckey
+ * does and returns its hook, whose key is the priority it was inserted
+ * with. Unless ckey_into is NULL, the ckey the item was carried with is
+ * stored there.
+ */
+softheap_hook *extract_min_hook(softheap *P, int *ckey_into);
+
+/* Where a heap's freed trees, nodes and cells go. FREE_NOW frees them
+ * on the spot, as usual. FREE_DEFERRED keeps them on a chain in the heap
+ * until softheap_reclaim is called (or the heap is destroyed), which keeps
+ * free, and any trimming malloc does inside it, off the extract path.
+ * FREE_BACKGROUND hands full batches of the chain to a reclaimer thread,
+ * started on first use, which frees them. */
+typedef enum {
+  SOFTHEAP_FREE_NOW,
+  SOFTHEAP_FREE_DEFERRED,
+  SOFTHEAP_FREE_BACKGROUND
+} softheap_free_mode;
+
+/**
+ * Function: softheap_set_free_mode
+ * --------------------------------
+ * Sets where P's frees go from now on (SOFTHEAP_FREE_NOW for a new heap).
+ * Switching to SOFTHEAP_FREE_NOW reclaims anything still deferred. A meld
+ * result uses the later of its arguments' modes in the order listed above.
+ */
+void softheap_set_free_mode(softheap *P, softheap_free_mode mode);
+
+/**
+ * Function: softheap_reclaim
+ * --------------------------
+ * Frees everything P has deferred, on the calling thread, and returns the
+ * number of objects freed. In FREE_BACKGROUND mode this covers whatever
+ * has not yet made up a batch for the reclaimer.
+ */
+size_t softheap_reclaim(softheap *P);
+
+/**
+ * Function: softheap_compact
+ * --------------------------
+ * Relocates the trees, nodes and item lists of P into fresh contiguous
+ * memory in depth-first order and returns the memory freed in the process
+ * to the operating system. Meant for after heavy extraction, when the
+ * survivors are scattered across a mostly empty heap: later extractions
+ * then walk memory mostly in address order. P's contents and behaviour
+ * are unchanged, and P may be compacted any number of times.
+ */
+void softheap_compact(softheap *P);
+
+/* Counters of the internal work done by soft heap operations. They are
+ * only maintained when the library is compiled with -DSOFTHEAP_STATS
+ * (make STATS=1); otherwise the counting compiles away entirely and the
+ * functions below report zeros. Counts are kept per thread. */
+typedef struct {
+  unsigned long sift_calls;       // calls to sift, including recursive ones
+  unsigned long sift_iterations;  // trips through sift's refill loop
+  unsigned long movelist_calls;   // list concatenations
+  unsigned long combine_calls;    // trees linked under a new root
+  unsigned long sufmin_steps;     // trees visited by update_suffix_min
+  unsigned long trees_created;
+  unsigned long trees_destroyed;
+  unsigned long allocs;           // trees, nodes, cells and heaps allocated
+  unsigned long frees;            // and freed
+} softheap_stats;
+
+/**
+ * Function: softheap_stats_enabled
+ * --------------------------------
+ * Returns true if the library was built with operation counters.
+ */
+bool softheap_stats_enabled(void);
+
+/**
+ * Function: softheap_get_stats
+ * ----------------------------
+ * Copies the calling thread's operation counters into the struct
+ * pointed to by into.
+ */
+void softheap_get_stats(softheap_stats *into);
+
+/**
+ * Function: softheap_reset_stats
+ * ------------------------------
+ * Zeroes the calling thread's operation counters.
+ */
+void softheap_reset_stats(void);
+
+/* Client-side operations reported to an observer. */
+typedef enum {
+  SH_OP_CREATE,  // heap was created (by makeheap or makeheap_empty)
+  SH_OP_INSERT,  // key was inserted into heap
+  SH_OP_EXTRACT, // key is the element just extracted from heap
+  SH_OP_MELD,    // heap and other were melded into result
+  SH_OP_DESTROY  // heap is about to be destroyed
+} softheap_op;
+
+/* Description of one observed operation. For a meld, heap and other are
+ * the arguments and result is the returned heap (always one of the two;
+ * the other has been freed by the time the observer runs). */
+typedef struct {
+  softheap_op op;
+  softheap *heap, *other, *result;
+  int key;
+} softheap_event;
+
+typedef void (*softheap_observer)(const softheap_event *ev, void *ctx);
+
+/**
+ * Function: softheap_set_observer
+ * -------------------------------
+ * Installs a process-wide observer that is called after every client-side
+ * operation (before, for destroy_heap), with ctx passed through. Pass NULL
+ * to remove it. Internal work such as the melds inside insert is not
+ * reported. When no observer is installed the cost is one predictable branch
+ * per operation. Used by the trace recorder in trace.h.
+ */
+void softheap_set_observer(softheap_observer obs, void *ctx);
+
+/**
+ * Function: softheap_epsilon
+ * --------------------------
+ * Returns the error parameter the heap was created with.
+ */
+double softheap_epsilon(softheap *P);
+
+/* Corruption audit of one heap. Only maintained when the library is
+ * compiled with -DSOFTHEAP_AUDIT (make AUDIT=1), a debugging mode in which
+ * every node also counts its corrupted items and every client operation
+ * checks that at most epsilon * inserts items are corrupted, exiting with
+ * an error if not. Items are their own keys, so an item is corrupted
+ * exactly when its key is below the ckey it travels with. A meld adds the
+ * record of the heap melded away into the result. */
+typedef struct {
+  long inserts;                // n: insertions into this heap and heaps melded into it
+  long corrupted;              // corrupted items currently in the heap
+  long max_corrupted;          // the most that were ever corrupted at once
+  long extractions;
+  long corrupted_extractions;  // extractions that returned a corrupted item
+  double total_inflation;      // sum of ckey - key over corrupted extractions
+  long max_inflation;          // largest ckey - key over corrupted extractions
+  bool last_corrupted;         // whether the latest extraction was corrupted
+  long last_inflation;         // and by how much its ckey exceeded its key
+} softheap_audit;
+
+/**
+ * Function: softheap_audit_enabled
+ * --------------------------------
+ * Returns true if the library was built with the corruption audit.
+ */
+bool softheap_audit_enabled(void);
+
+/**
+ * Function: softheap_get_audit
+ * ----------------------------
+ * Copies P's audit record into the struct pointed to by into (all zeros
+ * when the audit is compiled out). Call it right after an extraction to
+ * learn whether that item was corrupted and by how much.
+ */
+void softheap_get_audit(softheap *P, softheap_audit *into);
+
+/* Upper bound on tree and node ranks tracked by softheap_get_shape. Ranks
+ * grow like log2(n), so this is never reached in practice. */
+#define SOFTHEAP_MAX_RANK 64
+
+/* Buckets of the list-length histogram, by the ratio of a node's list
+ * length to its size parameter: empty, (0, 1/2), [1/2, 1), [1, 3/2),
+ * [3/2, 2), [2, 3), [3, 4), and 4 or more. */
+#define SOFTHEAP_LIST_BUCKETS 8
+
+/* A snapshot of a soft heap's structure, for tuning epsilon. */
+typedef struct {
+  double epsilon;
+  int r;                    // nodes of rank <= r have size 1 and hold no corrupted items
+  int rank;                 // rank of the highest-ranked tree, -1 if empty
+  long ntrees, nnodes, nleaves, nitems;
+  long corrupted;           // items whose ckey exceeds their key
+  long deficient_leaves;    // leaves holding fewer items than their size (cannot be refilled)
+  long deficient_internal;  // non-leaves holding fewer items than their size
+  long max_inflation;       // largest ckey - key over all items
+  long trees_by_rank[SOFTHEAP_MAX_RANK];    // number of roots of each rank
+  long nodes_by_rank[SOFTHEAP_MAX_RANK];
+  long items_by_rank[SOFTHEAP_MAX_RANK];    // total list length of the nodes of each rank
+  int size_by_rank[SOFTHEAP_MAX_RANK];      // the size parameter of nodes of each rank
+  long inflation_by_rank[SOFTHEAP_MAX_RANK]; // largest ckey - key in a node of each rank
+  long list_vs_size[SOFTHEAP_LIST_BUCKETS]; // nodes by list length / size, see above
+} softheap_shape;
+
+/**
+ * Function: softheap_get_shape
+ * ----------------------------
+ * Walks every tree, node and item of P and fills into with the statistics
+ * above. Keys waiting in the presorted-run buffer (see
+ * softheap_detect_runs) count as uncorrupted items of rank 0 that belong
+ * to no node. The walk is read-only: it changes neither the heap nor the
+ * operation counters, so it can be called at any point of a benchmark.
+ * It takes time linear in the number of items.
+ */
+void softheap_get_shape(softheap *P, softheap_shape *into);
+
 #endif // SOFTHEAP_H
@@ -1,13 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include <error.h>
 #include <time.h>
 #include <float.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "softheap.h"
+#include "bench.h"
+#include "workload.h"
+#include "sweep.h"
 #include "binheap.c"
 
 // Defines a function type used to sort integer arrays.
@@ -21,14 +27,274 @@ static bool sorted(int *A, size_t length) {
   return true;
 }
 
+/********************************************* KERNELS ***************************************/
+
+/* Small building blocks shared by the sorters below: insertion sort, a
+ * branchless merge, and AVX2 sorting networks with a bitonic merge. The
+ * AVX2 code is compiled for that instruction set function by function, so
+ * the rest of the program runs anywhere, and it is only called when the
+ * CPU reports AVX2 at run time (and -V has not turned it off). Otherwise
+ * the sorters fall back to the scalar kernels. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_KERNELS
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Largest block the sorting networks handle. */
+#define NETWORK_MAX 64
+
+static bool simd_disabled = false;
+
+/* Whether to use the AVX2 kernels. */
+static inline bool use_avx2(void) {
+#ifdef SIMD_KERNELS
+  return !simd_disabled && __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+/* Sort A by insertion. */
+static void insertion_sort(int *A, size_t length) {
+  for(size_t i = 1; i < length; i++) {
+    int x = A[i];
+    size_t j = i;
+    for(; j > 0 && A[j-1] > x; j--) A[j] = A[j-1];
+    A[j] = x;
+  }
+}
+
+/* Merge X[0..nx) and Y[0..ny) into out. The only branch in the loop is the
+ * (predictable) test for running out of either side: which side the next
+ * key comes from is a comparison result, used as a conditional move and
+ * as the amount each cursor advances. Ties take from X, so it is stable. */
+static void merge_branchless(const int *X, size_t nx, const int *Y, size_t ny, int *out) {
+  const int *xend = X + nx, *yend = Y + ny;
+  while(X < xend && Y < yend) {
+    int x = *X, y = *Y;
+    bool take_y = (y < x);
+    *out++ = (take_y ? y : x);
+    X += !take_y;
+    Y += take_y;
+  }
+  memcpy(out, X, (xend - X) * sizeof(int));
+  memcpy(out + (xend - X), Y, (yend - Y) * sizeof(int));
+}
+
+#ifdef SIMD_KERNELS
+
+/* The layers of a 19-comparator sorting network for 8 keys: each lane's
+ * partner in the layer, or itself if it sits the layer out. In sort8_lanes
+ * the lanes that take the larger key of their pair are given as blend
+ * masks, which must be immediates. */
+static const int network8_partner[6][8] = {
+  { 2, 3, 0, 1, 6, 7, 4, 5 }, { 4, 5, 6, 7, 0, 1, 2, 3 }, { 1, 0, 3, 2, 5, 4, 7, 6 },
+  { 0, 1, 4, 5, 2, 3, 6, 7 }, { 0, 4, 2, 6, 1, 5, 3, 7 }, { 0, 2, 1, 4, 3, 6, 5, 7 },
+};
+
+/* Compare-exchange every lane of v with its partner lane in perm; the lanes
+ * in mask (an immediate) keep the larger key. */
+#define LANE_CMPX(v, perm, mask) do {                                            \
+    __m256i t_ = _mm256_permutevar8x32_epi32(v, perm);                           \
+    v = _mm256_blend_epi32(_mm256_min_epi32(v, t_), _mm256_max_epi32(v, t_), mask); \
+  } while(0)
+
+/* Compare-exchange registers a and b lane by lane. */
+#define REG_CMPX(a, b) do {                                                      \
+    __m256i t_ = _mm256_min_epi32(a, b);                                         \
+    b = _mm256_max_epi32(a, b);                                                  \
+    a = t_;                                                                      \
+  } while(0)
+
+/* Sort the 8 lanes of v with the network. */
+static inline AVX2 __m256i sort8_lanes(__m256i v) {
+#define LAYER(l, mask) LANE_CMPX(v, _mm256_loadu_si256((const __m256i *)network8_partner[l]), mask)
+  LAYER(0, 0xCC);
+  LAYER(1, 0xF0);
+  LAYER(2, 0xAA);
+  LAYER(3, 0x30);
+  LAYER(4, 0x50);
+  LAYER(5, 0x54);
+#undef LAYER
+  return v;
+}
+
+/* Sort the columns of the 8 registers r with the same network, applied to
+ * whole registers. */
+static inline AVX2 void sort8_columns(__m256i *r) {
+  for(int l = 0; l < 6; l++)
+    for(int i = 0; i < 8; i++) {
+      int j = network8_partner[l][i] & 7; // the mask tells GCC that j is a lane
+      if(j > i) REG_CMPX(r[i], r[j]);
+    }
+}
+
+/* Transpose the 8x8 matrix of keys held in r, one row per register. */
+static inline AVX2 void transpose8(__m256i *r) {
+  __m256i t[8], u[8];
+  for(int i = 0; i < 8; i += 2) {
+    t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+    t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+  }
+  for(int i = 0; i < 8; i += 4) {
+    u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+    u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+    u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+    u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+  }
+  for(int i = 0; i < 4; i++) {
+    r[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+    r[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+  }
+}
+
+/* Reverse the lanes of v. */
+static inline AVX2 __m256i reverse8(__m256i v) {
+  return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+/* Sort a bitonic sequence of 8 lanes: compare-exchange at distance 4, then
+ * 2, then 1. */
+static inline AVX2 __m256i bitonic_clean8(__m256i v) {
+  __m256i t = _mm256_permute2x128_si256(v, v, 1);
+  v = _mm256_blend_epi32(_mm256_min_epi32(v, t), _mm256_max_epi32(v, t), 0xF0);
+  t = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+  v = _mm256_blend_epi32(_mm256_min_epi32(v, t), _mm256_max_epi32(v, t), 0xCC);
+  t = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm256_blend_epi32(_mm256_min_epi32(v, t), _mm256_max_epi32(v, t), 0xAA);
+}
+
+/* Merge the sorted runs r[0..k) and r[k..2k) of k registers each into one
+ * sorted run of 2k registers with a bitonic merge: reversing the second run
+ * makes the whole a bitonic sequence, which compare-exchanges at halving
+ * distances, first between registers and then within them, sort. */
+static inline AVX2 void bitonic_merge(__m256i *r, int k) {
+  for(int i = 0; i < k / 2; i++) {
+    __m256i t = r[k + i];
+    r[k + i] = r[2 * k - 1 - i];
+    r[2 * k - 1 - i] = t;
+  }
+  for(int i = k; i < 2 * k; i++) r[i] = reverse8(r[i]);
+  for(int d = k; d >= 1; d /= 2)
+    for(int i = 0; i < 2 * k; i++)
+      if(!(i & d)) REG_CMPX(r[i], r[i + d]);
+  for(int i = 0; i < 2 * k; i++) r[i] = bitonic_clean8(r[i]);
+}
+
+/* Sort the 8 * nregs keys at A (nregs 1, 2, 4 or 8) in registers. Eight
+ * registers are sorted column-wise and transposed, which leaves eight
+ * sorted rows for 19 register compare-exchanges; fewer are sorted lane-wise
+ * one register at a time. The sorted registers are then merged pairwise. */
+static AVX2 void network_sort_avx2(int *A, int nregs) {
+  __m256i r[8];
+  for(int i = 0; i < nregs; i++) r[i] = _mm256_loadu_si256((const __m256i *)(A + 8 * i));
+  if(nregs == 8) {
+    sort8_columns(r);
+    transpose8(r);
+  } else
+    for(int i = 0; i < nregs; i++) r[i] = sort8_lanes(r[i]);
+  for(int k = 1; k < nregs; k *= 2)
+    for(int i = 0; i < nregs; i += 2 * k) bitonic_merge(r + i, k);
+  for(int i = 0; i < nregs; i++) _mm256_storeu_si256((__m256i *)(A + 8 * i), r[i]);
+}
+
+/* Merge the sorted arrays X[0..nx) and Y[0..ny) into out, 8 keys at a time:
+ * a register of the 8 largest keys merged so far is merged with the next 8
+ * keys of whichever input has the smaller next key, and the lower 8 keys of
+ * the result are output. Once either input has fewer than 8 keys left, the
+ * carried register and that input's tail (fewer than 16 keys in all) are
+ * merged aside and then with the other input's tail. */
+static AVX2 void merge_avx2(const int *X, size_t nx, const int *Y, size_t ny, int *out) {
+  if(nx < 8 || ny < 8) {
+    merge_branchless(X, nx, Y, ny, out);
+    return;
+  }
+  __m256i r[2] = { _mm256_loadu_si256((const __m256i *)X), _mm256_loadu_si256((const __m256i *)Y) };
+  size_t i = 8, j = 8;
+  bitonic_merge(r, 1);
+  _mm256_storeu_si256((__m256i *)out, r[0]);
+  out += 8;
+  while(i + 8 <= nx && j + 8 <= ny) {
+    bool take_x = (X[i] <= Y[j]);
+    r[0] = _mm256_loadu_si256((const __m256i *)(take_x ? X + i : Y + j));
+    i += 8 * take_x;
+    j += 8 * !take_x;
+    bitonic_merge(r, 1);
+    _mm256_storeu_si256((__m256i *)out, r[0]);
+    out += 8;
+  }
+
+  int carry[8], small[16];
+  _mm256_storeu_si256((__m256i *)carry, r[1]);
+  if(nx - i < 8) {
+    merge_branchless(carry, 8, X + i, nx - i, small);
+    merge_branchless(small, 8 + nx - i, Y + j, ny - j, out);
+  } else {
+    merge_branchless(carry, 8, Y + j, ny - j, small);
+    merge_branchless(X + i, nx - i, small, 8 + ny - j, out);
+  }
+}
+
+#endif // SIMD_KERNELS
+
+/* Sort the length keys at A, at most NETWORK_MAX of them: with AVX2, by
+ * padding them with INT_MAX to 8, 16, 32 or 64 keys and running a sorting
+ * network; otherwise by insertion. */
+static void small_sort(int *A, size_t length) {
+#ifdef SIMD_KERNELS
+  if(length > 1 && use_avx2()) {
+    int nregs = 1;
+    while(8 * nregs < length) nregs *= 2;
+    if(length == 8 * nregs) {
+      network_sort_avx2(A, nregs);
+      return;
+    }
+    int block[NETWORK_MAX];
+    memcpy(block, A, length * sizeof(int));
+    for(int i = length; i < 8 * nregs; i++) block[i] = INT_MAX;
+    network_sort_avx2(block, nregs);
+    memcpy(A, block, length * sizeof(int));
+    return;
+  }
+#endif
+  insertion_sort(A, length);
+}
+
+/* Length up to which a sorter hands a subarray to small_sort: the longest
+ * block the networks sort with AVX2, or scalar, the sorter's own
+ * insertion-sort cutoff, without. */
+static inline size_t leaf_cutoff(size_t scalar) {
+  return (use_avx2() ? NETWORK_MAX : scalar);
+}
+
+/* Merge X[0..nx) and Y[0..ny) into out, with the AVX2 merge if we can. */
+static void merge_runs(const int *X, size_t nx, const int *Y, size_t ny, int *out) {
+#ifdef SIMD_KERNELS
+  if(use_avx2()) {
+    merge_avx2(X, nx, Y, ny, out);
+    return;
+  }
+#endif
+  merge_branchless(X, nx, Y, ny, out);
+}
+
 /******************************************** MERGESORT ****************************************/
 
+/* Length of the runs that the mergesorts insertion-sort (without AVX2)
+ * rather than split further or merge. */
+#define MERGE_RUN 16
+
 /* Call mergesort recursively on two halves of the subarray A[l..r].
  * Then copy the two halves into auxiliary arrays and do a two-way
  * merge of those auxiliary arrays back into A[l..r], so that the 
- * subarray ends up sorted. */
+ * subarray ends up sorted. Short subarrays go to small_sort instead. */
 static void mergesort(int *A, int *aux1, int *aux2, int l, int r) {
   if(l >= r) return;
+  if(r - l + 1 <= (int)leaf_cutoff(MERGE_RUN)) {
+    small_sort(A + l, r - l + 1);
+    return;
+  }
   
   // Recursively sort two halves
   int q = (l+r)/2;
@@ -55,8 +321,37 @@ static void mergesort(int *A, int *aux1, int *aux2, int l, int r) {
 
 
 static void mergesort_wrapper(int *A, size_t length) {
-  int aux1[(length+1)/2], aux2[(length+1)/2];
+  int *aux1 = malloc((length+1)/2 * sizeof(int)), *aux2 = malloc((length+1)/2 * sizeof(int));
+  if(aux1 == NULL || aux2 == NULL) error(1,0, "out of memory allocating mergesort buffers");
   mergesort(A, aux1, aux2, 0, length - 1);
+  free(aux1);
+  free(aux2);
+}
+
+/* Bottom-up mergesort: sort runs of MERGE_RUN (or NETWORK_MAX) keys with
+ * small_sort, then merge runs of doubling width, ping-ponging between A and
+ * a single buffer instead of copying the halves out at every level. */
+static void bottom_up_mergesort(int *A, size_t length) {
+  int *B = malloc(length * sizeof(int));
+  if(B == NULL) error(1,0, "out of memory allocating mergesort buffer");
+  size_t run = leaf_cutoff(MERGE_RUN);
+  for(size_t i = 0; i < length; i += run)
+    small_sort(A + i, (length - i < run ? length - i : run));
+
+  int *from = A, *to = B;
+  for(size_t width = run; width < length; width *= 2) {
+    for(size_t i = 0; i < length; i += 2 * width) {
+      size_t mid = (i + width < length ? i + width : length);
+      size_t end = (i + 2 * width < length ? i + 2 * width : length);
+      merge_runs(from + i, mid - i, from + mid, end - mid, to + i);
+    }
+    int *tmp = from;
+    from = to;
+    to = tmp;
+  }
+
+  if(from != A) memcpy(A, from, length * sizeof(int));
+  free(B);
 }
 
 /******************************************** HEAPSORT ****************************************/
@@ -95,10 +390,18 @@ static int partition(int *A, int l, int r) {
   return i-1;
 }
 
+/* Subarrays that quicksort insertion-sorts (without AVX2) rather than
+ * partition. */
+#define QUICKSORT_CUTOFF 16
+
 /* Implementation of quicksort with Hoare partitioning
- * and randomized pivot selection. */
+ * and randomized pivot selection. Short subarrays go to small_sort. */
 static void quicksort(int *A, int l, int r) {
   if(l >= r) return;
+  if(r - l + 1 <= (int)leaf_cutoff(QUICKSORT_CUTOFF)) {
+    small_sort(A + l, r - l + 1);
+    return;
+  }
   int rand_pivot = l + (rand() % (r - l + 1));
   swap(A, l, rand_pivot);
 
@@ -113,6 +416,134 @@ static inline void quicksort_wrapper(int *A, size_t length) {
   quicksort(A, 0, length - 1);
 }
 
+/************************************** BLOCK QUICKSORT ************************************/
+
+/* Tuning of block quicksort: the partition classifies keys in blocks of
+ * PARTITION_BLOCK, subarrays of at most INSERTION_CUTOFF keys (NETWORK_MAX
+ * with the AVX2 kernels) are left to small_sort, and pivots of subarrays longer than NINTHER_CUTOFF are
+ * ninthers rather than medians of three. */
+#define PARTITION_BLOCK 64
+#define INSERTION_CUTOFF 24
+#define NINTHER_CUTOFF 128
+
+/* Order A[a], A[b], A[c] so that A[b] holds their median. */
+static inline void sort3(int *A, size_t a, size_t b, size_t c) {
+  if(A[b] < A[a]) swap(A, a, b);
+  if(A[c] < A[b]) swap(A, b, c);
+  if(A[b] < A[a]) swap(A, a, b);
+}
+
+/* Move the pivot of A[0..n) to A[0]: the median of the first, middle and
+ * last keys, or for long subarrays Tukey's ninther, the median of three
+ * such medians, which is far harder to steer towards a bad split. */
+static void choose_pivot(int *A, size_t n) {
+  size_t mid = n / 2;
+  if(n > NINTHER_CUTOFF) {
+    sort3(A, 0, mid, n - 1);
+    sort3(A, 1, mid - 1, n - 2);
+    sort3(A, 2, mid + 1, n - 3);
+    sort3(A, mid - 1, mid, mid + 1);
+  } else sort3(A, 0, mid, n - 1);
+  swap(A, 0, mid);
+}
+
+/* Partition A[1..n) around the pivot p = A[0] into keys below p on the left
+ * and the rest on the right, or with strict set, keys up to p on the left
+ * and keys above p on the right; then move p between the two and return
+ * its index. As in BlockQuicksort, the keys are classified a block at a
+ * time from each end, recording the offsets of misplaced keys by adding a
+ * comparison result to a counter rather than branching on it, and the
+ * misplaced keys of the two blocks are then swapped pairwise. The last two
+ * blocks or so are finished with an ordinary Hoare scan. */
+static inline size_t block_partition(int *A, size_t n, bool strict) {
+  int p = A[0];
+  unsigned char offsets_l[PARTITION_BLOCK], offsets_r[PARTITION_BLOCK];
+  size_t l = 1, r = n - 1; // A[1..l) is on the left and A(r..n) on the right
+  int num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+
+  while(r - l + 1 > 2 * PARTITION_BLOCK) {
+    if(num_l == 0) {
+      start_l = 0;
+      for(int i = 0; i < PARTITION_BLOCK; i++) {
+        offsets_l[num_l] = i;
+        num_l += (strict ? A[l + i] > p : A[l + i] >= p);
+      }
+    }
+    if(num_r == 0) {
+      start_r = 0;
+      for(int i = 0; i < PARTITION_BLOCK; i++) {
+        offsets_r[num_r] = i;
+        num_r += (strict ? A[r - i] <= p : A[r - i] < p);
+      }
+    }
+    int num = (num_l < num_r ? num_l : num_r);
+    for(int j = 0; j < num; j++) swap(A, l + offsets_l[start_l + j], r - offsets_r[start_r + j]);
+    num_l -= num;
+    num_r -= num;
+    start_l += num;
+    start_r += num;
+    if(num_l == 0) l += PARTITION_BLOCK;
+    if(num_r == 0) r -= PARTITION_BLOCK;
+  }
+
+  // A partly swapped block may remain at either end, so scan everything between
+  size_t i = l, j = r + 1;
+  while(true) {
+    while(i < j && (strict ? A[i] <= p : A[i] < p)) i++;
+    while(i < j && (strict ? A[j - 1] > p : A[j - 1] >= p)) j--;
+    if(i == j) break;
+    swap(A, i++, --j); // both stopped, so A[i] and A[j - 1] are distinct and misplaced
+  }
+
+  swap(A, 0, i - 1);
+  return i - 1;
+}
+
+/* Sort A[0..n) with block partitioning. The smaller side of each partition
+ * is sorted recursively and the larger one by the loop, so the stack stays
+ * O(log n) deep. After depth unlucky levels the subarray is heapsorted
+ * instead, which bounds the worst case at O(n log n). As in pdqsort, a
+ * subarray that is not leftmost has a key just before it that is no larger
+ * than any key in it. If the pivot equals that key, the keys equal to it
+ * are swept to the left in one partition and never looked at again, so
+ * inputs with few distinct keys take linear time per distinct key. */
+static void block_quicksort(int *A, size_t n, int depth, bool leftmost) {
+  size_t cutoff = leaf_cutoff(INSERTION_CUTOFF);
+  while(n > cutoff) {
+    if(depth-- == 0) {
+      heapsort(A, n);
+      return;
+    }
+    choose_pivot(A, n);
+    if(!leftmost && A[-1] == A[0]) {
+      size_t k = block_partition(A, n, true);
+      A += k + 1;
+      n -= k + 1;
+      continue;
+    }
+
+    size_t k = block_partition(A, n, false);
+    if(k < n - k - 1) {
+      block_quicksort(A, k, depth, leftmost);
+      A += k + 1;
+      n -= k + 1;
+      leftmost = false;
+    } else {
+      block_quicksort(A + k + 1, n - k - 1, depth, false);
+      n = k;
+    }
+  }
+  small_sort(A, n);
+}
+
+/* Calls block quicksort on all of A, allowing 2 log2(n) levels of
+ * recursion before falling back to heapsort. */
+static void block_quicksort_wrapper(int *A, size_t length) {
+  int depth = 0;
+  for(size_t m = length; m > 1; m /= 2) depth += 2;
+  block_quicksort(A, length, depth, true);
+}
+
 /******************************************** GNU QSORT ****************************************/
 
 /* Callback function to compare the values of two integers ala strcmp. */
@@ -145,123 +576,527 @@ static void softheap_sort(int *A, size_t length) {
 
 /***************************************** RADIX SORT ****************************************/
 
-/* Do a counting sort over the curr_dig-th least significant digit of the elements
- * of input (in base b), and put the contents into output. */
-static void radix_pass(int *input, int *output, size_t length, int b, int divisor) {
-  int counter[b];
-  memset(counter, 0, sizeof(int) * b); // set digit counts to 0
-   
-  // Count the number of representatives there are of each digit across all values
-  for(int i = 0; i < length; i++) {
-    int dig_i = (input[i] / divisor) % b; 
-    counter[dig_i]++;
+/* Digit width of the radix sorts: 8 bits gives 4 passes over 32-bit keys
+ * (8 over 64-bit ones) with histograms small enough to stay in L1. 11 bits
+ * (3 passes) was 15% slower at 10^5 keys and 10-25% faster from 10^6 up. */
+#define RADIX_BITS 8
+#define RADIX (1 << RADIX_BITS)
+
+/* Digit passes needed to sort keys of the given type, rounded up so that a
+ * RADIX_BITS that does not divide the key width still sorts the top digit. */
+#define RADIX_PASSES(type) ((sizeof(type) * 8 + RADIX_BITS - 1) / RADIX_BITS)
+
+/* Define an LSD radix sort named name for arrays of the signed integer type
+ * type, whose unsigned counterpart is utype. A single read of the input
+ * counts the digits of every pass at once. A pass in which all keys share a
+ * digit would only copy the array, so it is skipped. Keys are sorted as
+ * unsigned numbers with the sign bit flipped, which puts negative keys
+ * first. The passes ping-pong between A and one heap buffer. */
+#define DEFINE_RADIX_SORT(name, type, utype)                                          \
+static void name(type *A, size_t length) {                                            \
+  enum { NPASSES = RADIX_PASSES(type) };                                              \
+  const utype flip = (utype)1 << (sizeof(type) * 8 - 1);                              \
+  if(length < 2) return;                                                              \
+  size_t (*counts)[RADIX] = calloc(NPASSES, sizeof(*counts));                         \
+  type *B = malloc(length * sizeof(type));                                            \
+  if(counts == NULL || B == NULL) error(1,0, "out of memory allocating radix sort buffers"); \
+                                                                                      \
+  for(size_t i = 0; i < length; i++) {                                                \
+    utype u = (utype)A[i] ^ flip;                                                     \
+    for(int p = 0; p < NPASSES; p++) counts[p][(u >> (p * RADIX_BITS)) & (RADIX - 1)]++; \
+  }                                                                                   \
+                                                                                      \
+  type *from = A, *to = B;                                                            \
+  for(int p = 0; p < NPASSES; p++) {                                                  \
+    int shift = p * RADIX_BITS;                                                       \
+    size_t *c = counts[p];                                                            \
+    if(c[(((utype)A[0] ^ flip) >> shift) & (RADIX - 1)] == length) continue;         \
+                                                                                      \
+    /* Turn the counts into the first output index of each digit */                   \
+    size_t sum = 0;                                                                   \
+    for(int d = 0; d < RADIX; d++) {                                                  \
+      size_t count = c[d];                                                            \
+      c[d] = sum;                                                                     \
+      sum += count;                                                                   \
+    }                                                                                 \
+    for(size_t i = 0; i < length; i++) {                                              \
+      utype u = (utype)from[i] ^ flip;                                                \
+      to[c[(u >> shift) & (RADIX - 1)]++] = from[i];                                  \
+    }                                                                                 \
+    type *tmp = from;                                                                 \
+    from = to;                                                                        \
+    to = tmp;                                                                         \
+  }                                                                                   \
+                                                                                      \
+  if(from != A) memcpy(A, from, length * sizeof(type));                               \
+  free(B);                                                                            \
+  free(counts);                                                                       \
+}
+
+DEFINE_RADIX_SORT(radix_sort, int, unsigned)
+DEFINE_RADIX_SORT(radix_sort64, int64_t, uint64_t)
+
+/* Sort A by widening its keys to 64 bits, radix sorting those and narrowing
+ * them back, to time the 64-bit sort on the same inputs as the rest. */
+static void radix_sort64_wrapper(int *A, size_t length) {
+  int64_t *wide = malloc(length * sizeof(int64_t));
+  if(wide == NULL) error(1,0, "out of memory allocating 64-bit keys");
+  for(size_t i = 0; i < length; i++) wide[i] = A[i];
+  radix_sort64(wide, length);
+  for(size_t i = 0; i < length; i++) A[i] = wide[i];
+  free(wide);
+}
+
+/**************************************** PARALLEL SORTS ***************************************/
+
+/* Threads used by the parallel sorters, or 0 for one per online CPU. Each
+ * thread gets at least PARALLEL_MIN_SLICE keys, or spawning it would cost
+ * more than it saves. */
+static int sort_threads = 0;
+#define PARALLEL_MIN_SLICE 16384
+
+/* State shared by the threads of one parallel sort. Thread k owns the k-th
+ * of nthreads equal slices of the input, and the threads step through the
+ * phases of the sort together, meeting at the barrier between phases. */
+typedef struct {
+  int *A, *B;
+  size_t length;
+  int nthreads;
+  pthread_barrier_t barrier;
+  size_t (*hist)[RADIX_PASSES(int)][RADIX]; // radix sort: per-thread digit counts
+} parallel_sort;
+
+typedef struct {
+  parallel_sort *ps;
+  int id;
+} parallel_worker;
+
+/* Number of threads to sort length keys with. */
+static int parallel_threads(size_t length) {
+  size_t nthreads = (sort_threads > 0 ? sort_threads : sweep_default_threads());
+  if(nthreads > length / PARALLEL_MIN_SLICE) nthreads = length / PARALLEL_MIN_SLICE;
+  return (nthreads > 0 ? nthreads : 1);
+}
+
+/* Start of thread k's slice of length keys. */
+static inline size_t slice_start(size_t length, int nthreads, int k) {
+  return length * k / nthreads;
+}
+
+/* Run body on ps->nthreads threads, the calling thread being worker 0. */
+static void run_parallel(parallel_sort *ps, void *(*body)(void *)) {
+  int n = ps->nthreads;
+  pthread_t *threads = malloc(n * sizeof(pthread_t));
+  parallel_worker *workers = malloc(n * sizeof(parallel_worker));
+  if(threads == NULL || workers == NULL) error(1,0, "out of memory starting sort threads");
+  pthread_barrier_init(&ps->barrier, NULL, n);
+
+  for(int k = 0; k < n; k++) workers[k] = (parallel_worker){ ps, k };
+  for(int k = 1; k < n; k++)
+    if(pthread_create(&threads[k], NULL, body, &workers[k]) != 0) error(1,0, "cannot start sort thread");
+  body(&workers[0]);
+  for(int k = 1; k < n; k++) pthread_join(threads[k], NULL);
+
+  pthread_barrier_destroy(&ps->barrier);
+  free(threads);
+  free(workers);
+}
+
+/* One thread of the parallel radix sort. The threads count the digits of
+ * their slices for every pass in one read, as radix_sort does, and skip the
+ * same trivial passes. In each pass that remains, every thread counts the
+ * digits of its slice (the first pass reuses the initial counts), thread 0
+ * turns the counts into each thread's first output index per digit, digit
+ * by digit and within a digit thread by thread, and every thread scatters
+ * its slice. Slices are scattered in order, so every pass is stable. */
+static void *parallel_radix_worker(void *arg) {
+  parallel_worker *w = arg;
+  parallel_sort *ps = w->ps;
+  enum { NPASSES = RADIX_PASSES(int) };
+  const unsigned flip = 1u << (sizeof(int) * 8 - 1);
+  int T = ps->nthreads, k = w->id;
+  size_t lo = slice_start(ps->length, T, k), hi = slice_start(ps->length, T, k + 1);
+  size_t (*hist)[RADIX] = ps->hist[k];
+
+  memset(hist, 0, sizeof(ps->hist[k]));
+  for(size_t i = lo; i < hi; i++) {
+    unsigned u = (unsigned)ps->A[i] ^ flip;
+    for(int p = 0; p < NPASSES; p++) hist[p][(u >> (p * RADIX_BITS)) & (RADIX - 1)]++;
   }
+  pthread_barrier_wait(&ps->barrier);
 
-  // Change counter so that counter[i] counts how many elements have appropriate LSD
-  // less than or equal to i. This is 1 plus the max index at which an element 
-  // with that digit should appear in a zero-indexed array. 
-  for(int i = 1; i < b; i++) {
-    counter[i] += counter[i-1];
+  // Every thread decides the same skips from the totals, before any count is overwritten
+  bool skip[NPASSES];
+  unsigned first = (unsigned)ps->A[0] ^ flip;
+  for(int p = 0; p < NPASSES; p++) {
+    size_t same = 0;
+    for(int t = 0; t < T; t++) same += ps->hist[t][p][(first >> (p * RADIX_BITS)) & (RADIX - 1)];
+    skip[p] = (same == ps->length);
   }
-  
-  for(int i = length - 1; i >= 0; i--) {
-    int elem = input[i];
-    int dig_i = (elem / divisor) % b;
-    output[counter[dig_i] - 1] = elem;
-    counter[dig_i]--; // so that next elem with this digit can be placed before this one
+
+  int *from = ps->A, *to = ps->B;
+  bool counted = true; // the initial counts hold for the first pass only
+  for(int p = 0; p < NPASSES; p++) {
+    int shift = p * RADIX_BITS;
+    if(skip[p]) continue;
+
+    if(!counted) {
+      memset(hist[p], 0, sizeof(hist[p]));
+      for(size_t i = lo; i < hi; i++) hist[p][(((unsigned)from[i] ^ flip) >> shift) & (RADIX - 1)]++;
+    }
+    pthread_barrier_wait(&ps->barrier);
+    if(k == 0) {
+      size_t sum = 0;
+      for(int d = 0; d < RADIX; d++)
+        for(int t = 0; t < T; t++) {
+          size_t count = ps->hist[t][p][d];
+          ps->hist[t][p][d] = sum;
+          sum += count;
+        }
+    }
+    pthread_barrier_wait(&ps->barrier);
+
+    for(size_t i = lo; i < hi; i++) to[hist[p][(((unsigned)from[i] ^ flip) >> shift) & (RADIX - 1)]++] = from[i];
+    pthread_barrier_wait(&ps->barrier);
+    int *tmp = from;
+    from = to;
+    to = tmp;
+    counted = false;
+  }
+
+  if(from != ps->A) memcpy(ps->A + lo, from + lo, (hi - lo) * sizeof(int));
+  return NULL;
+}
+
+/* Sort A with the parallel LSD radix sort, or the serial one if a single
+ * thread would do the work. */
+static void parallel_radix_sort(int *A, size_t length) {
+  int nthreads = parallel_threads(length);
+  if(nthreads == 1) {
+    radix_sort(A, length);
+    return;
   }
+  parallel_sort ps = { A, malloc(length * sizeof(int)), length, nthreads };
+  ps.hist = malloc(ps.nthreads * sizeof(*ps.hist));
+  if(ps.B == NULL || ps.hist == NULL) error(1,0, "out of memory allocating radix sort buffers");
+  run_parallel(&ps, parallel_radix_worker);
+  free(ps.B);
+  free(ps.hist);
 }
 
-/* Perform a base-10 radix sort on the elements of A. */
-static void radix_sort(int *A, size_t length) {
-  int b = 10; // radix sort base
-  int ndigits = ceil(log(RAND_MAX)/log(b));
-  int B[length];
-  memset(B, 0, sizeof(int) * length); // Valgrind gets pissed if I don't do this
+/* Co-ranking: the number of keys that the first k outputs of a stable merge
+ * of X (nx keys) and Y (ny keys) take from X. Ties go to X first. */
+static size_t co_rank(size_t k, const int *X, size_t nx, const int *Y, size_t ny) {
+  size_t lo = (k > ny ? k - ny : 0), hi = (k < nx ? k : nx);
+  while(true) {
+    size_t i = lo + (hi - lo) / 2, j = k - i;
+    if(i < nx && j > 0 && Y[j-1] >= X[i]) lo = i + 1;     // took too few from X
+    else if(i > 0 && j < ny && X[i-1] > Y[j]) hi = i - 1; // took too many from X
+    else return i;
+  }
+}
+
+/* One thread of the parallel mergesort. Each thread mergesorts its slice,
+ * then the sorted runs are merged pairwise in rounds. All threads share
+ * every merge of a round: thread k produces the k-th equal share of the
+ * merged output, finding where its share starts in each run by co-ranking,
+ * so the work stays balanced however unevenly the runs interleave. */
+static void *parallel_merge_worker(void *arg) {
+  parallel_worker *w = arg;
+  parallel_sort *ps = w->ps;
+  int T = ps->nthreads, k = w->id;
+  size_t n = ps->length;
+  size_t lo = slice_start(n, T, k), hi = slice_start(n, T, k + 1), m = hi - lo;
 
-  int divisor = 1; // (x / divisor) % (b) is the log_b(divisor)th least sigdig of x
+  // The slice of B is scratch for the two halves mergesort copies out
+  if(m > 1) mergesort(ps->A + lo, ps->B + lo, ps->B + lo + (m + 1) / 2, 0, m - 1);
+  pthread_barrier_wait(&ps->barrier);
 
-  for(int i = 0; i < ndigits; i++) {
-    // On even-numbered runs, current progress moves A->B; on even, B->A
-    if(i % 2 == 0) radix_pass(A, B, length, b, divisor);
-    else radix_pass(B, A, length, b, divisor);
-    divisor *= b;
+  int *from = ps->A, *to = ps->B;
+  for(int width = 1; width < T; width *= 2) {
+    for(int s = 0; s < T; s += 2 * width) {
+      size_t a = slice_start(n, T, s);
+      size_t b = slice_start(n, T, (s + width < T ? s + width : T));
+      size_t c = slice_start(n, T, (s + 2 * width < T ? s + 2 * width : T));
+      const int *X = from + a, *Y = from + b;
+      size_t nx = b - a, ny = c - b, total = c - a;
+      size_t out_lo = total * k / T, out_hi = total * (k + 1) / T;
+      size_t i0 = co_rank(out_lo, X, nx, Y, ny), i1 = co_rank(out_hi, X, nx, Y, ny);
+      merge_branchless(X + i0, i1 - i0, Y + (out_lo - i0), (out_hi - i1) - (out_lo - i0), to + a + out_lo);
+    }
+    pthread_barrier_wait(&ps->barrier);
+    int *tmp = from;
+    from = to;
+    to = tmp;
   }
 
-  // After the final pass, the sorted array will be B if ndigits was odd.
-  // If this is the case, copy B into A to complete the sort.
-  if(ndigits % 2 == 1) memcpy(A, B, length * sizeof(int));
+  if(from != ps->A) memcpy(ps->A + lo, from + lo, m * sizeof(int));
+  return NULL;
 }
 
+/* Sort A with the parallel mergesort, or the serial one if a single thread
+ * would do the work. */
+static void parallel_mergesort(int *A, size_t length) {
+  int nthreads = parallel_threads(length);
+  if(nthreads == 1) {
+    mergesort_wrapper(A, length);
+    return;
+  }
+  parallel_sort ps = { A, malloc(length * sizeof(int)), length, nthreads };
+  if(ps.B == NULL) error(1,0, "out of memory allocating mergesort buffer");
+  run_parallel(&ps, parallel_merge_worker);
+  free(ps.B);
+}
+
+/* Table of the sorters compared by this driver, in the order they are run.
+ * A parallel sorter names the serial sorter its speedup is measured
+ * against, which must come earlier in the table. */
+static const struct {
+  sorter sort;
+  char *name;
+  char *serial;
+} sorters[] = {
+  { mergesort_wrapper, "mergesort" },
+  { bottom_up_mergesort, "bottom-up mergesort" },
+  { heapsort, "heapsort" },
+  { quicksort_wrapper, "quicksort" },
+  { block_quicksort_wrapper, "block quicksort" },
+  { gnu_qsort_wrapper, "GNU qsort" },
+  { radix_sort, "radix sort" },
+  { radix_sort64_wrapper, "radix sort (64-bit)" },
+  { softheap_sort, "softheap sort" },
+  { parallel_radix_sort, "parallel radix", "radix sort" },
+  { parallel_mergesort, "parallel mergesort", "mergesort" },
+};
+
 /******************************************** TIMING ****************************************/
 
-/* Call the sorting algorithm of choice on a copy on the original array of
- * random elements. Report timing results. */
-static void time_sort(int *A, size_t length, sorter sort, char *sort_name) {
-  printf("----------------- Timing %s ------------------\n", sort_name);
-  printf("Making copy of original array...\n");
-  int B[length];
-  memcpy(B, A, length * sizeof(int));
+/* State shared with the benchmark harness while timing one sorter: the
+ * template array, the scratch copy that is actually sorted, and the sorter. */
+typedef struct {
+  int *A, *B;
+  size_t length;
+  sorter sort;
+} sort_bench;
 
-  printf("Timing %s on array...\n", sort_name);
+/* Untimed setup: refresh the scratch copy from the template array. */
+static void sort_setup(void *ctx) {
+  sort_bench *sb = ctx;
+  memcpy(sb->B, sb->A, sb->length * sizeof(int));
+}
 
-  clock_t tick = clock();
-  sort(B, length);
-  clock_t tock = clock();
-  double elapsed_secs = (double)(tock - tick) / CLOCKS_PER_SEC;
-  
-  if(!sorted(B, length)) error(1,0, "%s failed", sort_name);
-  printf("Success.\n");
-  printf("%s\t %4.6f s \n\n", sort_name, elapsed_secs);  
+/* Timed body: sort the scratch copy. */
+static void sort_run(void *ctx) {
+  sort_bench *sb = ctx;
+  sb->sort(sb->B, sb->length);
 }
 
+/* Other drivers (scaling.c) include this file for its sorters and timing
+ * callbacks; they define SORTS_NO_MAIN to leave out the rest. */
+#ifndef SORTS_NO_MAIN
+
+/* Call the sorting algorithm of choice repeatedly on copies of the original
+ * array of random elements and report timing results. A parallel sorter
+ * also reports its thread count and, given the median time of its serial
+ * counterpart, its speedup over it. Returns the median time. */
+static double time_sort(const bench_config *cfg, int *A, size_t length, sorter sort, char *sort_name,
+                        const char *dist, bool parallel, double serial_median) {
+  sort_bench sb = { A, malloc(length * sizeof(int)), length, sort };
+  if(sb.B == NULL) error(1,0, "out of memory copying array for %s", sort_name);
+
+  bench_ops ops = { sort_setup, sort_run, NULL };
+  bench_result res;
+  bench_run(cfg, &ops, &sb, length, &res);
+  
+  if(!sorted(sb.B, length)) error(1,0, "%s failed", sort_name);
+  char param[96];
+  snprintf(param, sizeof(param), "%s", dist);
+  if(parallel) {
+    snprintf(param, sizeof(param), "%s;threads=%d", dist, parallel_threads(length));
+    if(serial_median > 0) bench_add_metric(&res, "speedup", serial_median / res.median);
+  }
+  bench_report(cfg, "sorts", sort_name, param, length, &res);
+  free(sb.B);
+  return res.median;
+}
 
-static inline void time_heapsort(int *A, size_t length) {
-  time_sort(A, length, heapsort, "heapsort");
+/* Sort each block of block keys of A (the last one may be shorter) on its
+ * own, block being at most NETWORK_MAX. */
+static void sort_blocks(int *A, size_t length, size_t block) {
+  for(size_t i = 0; i < length; i += block)
+    small_sort(A + i, (length - i < block ? length - i : block));
 }
 
-static inline void time_quicksort(int *A, size_t length) {
-  time_sort(A, length, quicksort_wrapper, "quicksort");
+/* Merge each pair of adjacent sorted runs of run keys in A into out. */
+static void merge_blocks(const int *A, int *out, size_t length, size_t run) {
+  for(size_t i = 0; i < length; i += 2 * run) {
+    size_t mid = (i + run < length ? i + run : length);
+    size_t end = (i + 2 * run < length ? i + 2 * run : length);
+    merge_runs(A + i, mid - i, A + mid, end - mid, out + i);
+  }
 }
 
-static inline void time_softheap_sort(int *A, size_t length) {
-  time_sort(A, length, softheap_sort, "softheap sort");
+/* Kernels timed by the kernel study (-k). Each sorts or merges blocks of a
+ * given size, or with size 0 sorts the whole array. */
+typedef enum { KERNEL_NETWORK, KERNEL_MERGE, KERNEL_SORTER } kernel_kind;
+
+static const struct {
+  kernel_kind kind;
+  char *name;
+  size_t size;
+  sorter sort;
+} kernels[] = {
+  { KERNEL_NETWORK, "sorting network", 8 },
+  { KERNEL_NETWORK, "sorting network", 16 },
+  { KERNEL_NETWORK, "sorting network", 32 },
+  { KERNEL_NETWORK, "sorting network", 64 },
+  { KERNEL_MERGE, "merge", 8 },
+  { KERNEL_MERGE, "merge", 64 },
+  { KERNEL_MERGE, "merge", 1024 },
+  { KERNEL_SORTER, "mergesort", 0, mergesort_wrapper },
+  { KERNEL_SORTER, "bottom-up mergesort", 0, bottom_up_mergesort },
+  { KERNEL_SORTER, "quicksort", 0, quicksort_wrapper },
+  { KERNEL_SORTER, "block quicksort", 0, block_quicksort_wrapper },
+};
+
+/* State shared with the benchmark harness while timing one kernel. For a
+ * merge, A is the input already sorted in runs and B the output. */
+typedef struct {
+  int *A, *B;
+  size_t length;
+  int kernel;
+  bool scalar;
+} kernel_bench;
+
+/* Untimed setup: select the kernels and refresh the scratch copy. */
+static void kernel_setup(void *ctx) {
+  kernel_bench *kb = ctx;
+  simd_disabled = kb->scalar;
+  if(kernels[kb->kernel].kind != KERNEL_MERGE) memcpy(kb->B, kb->A, kb->length * sizeof(int));
 }
 
-static inline void time_gnu_qsort(int *A, size_t length) {
-  time_sort(A, length, gnu_qsort_wrapper, "GNU qsort");
+/* Timed body: run the kernel over the whole array. */
+static void kernel_run(void *ctx) {
+  kernel_bench *kb = ctx;
+  size_t size = kernels[kb->kernel].size;
+  switch(kernels[kb->kernel].kind) {
+  case KERNEL_NETWORK: sort_blocks(kb->B, kb->length, size); break;
+  case KERNEL_MERGE: merge_blocks(kb->A, kb->B, kb->length, size); break;
+  case KERNEL_SORTER: kernels[kb->kernel].sort(kb->B, kb->length); break;
+  }
 }
 
-static inline void time_mergesort(int *A, size_t length) {
-  time_sort(A, length, mergesort_wrapper, "mergesort");
+/* Check that every block of block keys of A (all of A if block is 0) is sorted. */
+static bool blocks_sorted(int *A, size_t length, size_t block) {
+  if(block == 0) block = length;
+  for(size_t i = 0; i < length; i += block)
+    if(!sorted(A + i, (length - i < block ? length - i : block))) return false;
+  return true;
 }
 
-static inline void time_radix_sort(int *A, size_t length) {
-  time_sort(A, length, radix_sort, "radix sort");
+/* Time every kernel on A with the scalar kernels and, if the CPU has AVX2,
+ * the AVX2 ones, reporting the speedup of AVX2 over scalar per kernel and
+ * block size. */
+static void time_kernels(const bench_config *cfg, int *A, size_t length, const char *dist) {
+  bool avx2 = use_avx2();
+  kernel_bench kb = { malloc(length * sizeof(int)), malloc(length * sizeof(int)), length };
+  if(kb.A == NULL || kb.B == NULL) error(1,0, "out of memory copying array for the kernel study");
+  bench_ops ops = { kernel_setup, kernel_run, NULL };
+
+  for(int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    size_t size = kernels[k].size;
+    memcpy(kb.A, A, length * sizeof(int));
+    if(kernels[k].kind == KERNEL_MERGE) {
+      simd_disabled = true;
+      for(size_t run = 1; run < size; run *= 2) {
+        merge_blocks(kb.A, kb.B, length, run);
+        memcpy(kb.A, kb.B, length * sizeof(int));
+      }
+    }
+
+    double scalar_median = 0;
+    for(int pass = 0; pass < (avx2 ? 2 : 1); pass++) {
+      kb.kernel = k;
+      kb.scalar = (pass == 0);
+      bench_result res;
+      bench_run(cfg, &ops, &kb, length, &res);
+      if(!blocks_sorted(kb.B, length, (kernels[k].kind == KERNEL_MERGE ? 2 * size : size)))
+        error(1,0, "%s kernel failed", kernels[k].name);
+
+      char param[96];
+      snprintf(param, sizeof(param), "%s;block=%zu;kernels=%s", dist, size, (kb.scalar ? "scalar" : "avx2"));
+      if(kb.scalar) scalar_median = res.median;
+      else bench_add_metric(&res, "speedup", scalar_median / res.median);
+      bench_report(cfg, "sort-kernels", kernels[k].name, param, length, &res);
+    }
+  }
+
+  simd_disabled = false;
+  free(kb.A);
+  free(kb.B);
 }
 
+/* Command-line settings specific to this driver. */
+typedef struct {
+  workload_spec spec;
+  uint64_t seed;
+  bool kernels;
+} sort_options;
 
+/* Handle the driver-specific -d (key distribution), -s (seed), -j
+ * (threads for the parallel sorters), -V (scalar kernels only) and -k
+ * (kernel study) options. */
+static void parse_extra(int opt, const char *arg, void *ctx) {
+  sort_options *o = ctx;
+  if(opt == 'd' && !workload_parse(arg, &o->spec)) error(1,0, "unknown key distribution '%s'", arg);
+  if(opt == 's') o->seed = strtoull(arg, NULL, 10);
+  if(opt == 'j') sort_threads = atoi(arg);
+  if(opt == 'V') simd_disabled = true;
+  if(opt == 'k') o->kernels = true;
+}
 
 int main(int argc, char *argv[]) {
-  if(argc != 2) error(1,0, "usage: ./sorts [nelems]");
-  int nelems = atoi(argv[1]);
+  sort_options o = { { DIST_UNIFORM, 0, 0 }, time(NULL), false };
+  bench_config cfg;
+  bench_default_config(&cfg);
+  int argi = bench_parse_options(&cfg, argc, argv, "d:s:j:Vk", parse_extra, &o);
+  if(argc - argi != 1) {
+    bench_usage(stderr);
+    error(1,0, "usage: ./sorts [options] [-d dist[:param[:shape]]] [-s seed] [-j threads] [-V] [-k] [nelems]");
+  }
+  int nelems = atoi(argv[argi]);
   if(nelems <= 0) error(1,0, "nelems must be a valid integer greater than or equal to 1");
 
-  long long seed = time(NULL);
-  srand(seed);
-  printf("Random seed: %lld\n", seed);
+  srand(o.seed);
+  rng g;
+  rng_seed(&g, o.seed);
+  fprintf(stderr, "Random seed: %llu\n", (unsigned long long)o.seed);
 
-  printf("Creating a template array of %d random elements...\n", nelems);
-  int A[nelems];
-  for(int i = 0; i < nelems; i++) A[i] = rand();
-  printf("Done. Starting tests...\n\n");
+  int *A = malloc(nelems * sizeof(int));
+  if(A == NULL) error(1,0, "out of memory creating template array");
+  workload_fill(A, nelems, &o.spec, &g);
+  char dist[64];
+  workload_describe(&o.spec, dist, sizeof(dist));
 
-  time_mergesort(A, nelems);
-  time_heapsort(A, nelems);
-  time_quicksort(A, nelems);
-  time_gnu_qsort(A, nelems);
-  time_radix_sort(A, nelems);
-  time_softheap_sort(A, nelems);   
+  bench_report_begin(&cfg);
+  if(o.kernels) {
+    if(simd_disabled) error(1,0, "-k compares the AVX2 kernels with the scalar ones; drop -V");
+    time_kernels(&cfg, A, nelems, dist);
+    free(A);
+    return 0;
+  }
+  size_t nsorters = sizeof(sorters) / sizeof(sorters[0]);
+  double medians[nsorters];
+  for(size_t i = 0; i < nsorters; i++) {
+    double serial = 0;
+    for(size_t j = 0; j < i && sorters[i].serial != NULL; j++)
+      if(strcmp(sorters[j].name, sorters[i].serial) == 0) serial = medians[j];
+    medians[i] = time_sort(&cfg, A, nelems, sorters[i].sort, sorters[i].name, dist,
+                           sorters[i].serial != NULL, serial);
+  }
 
+  free(A);
   return 0;
 }
+
+#endif // SORTS_NO_MAIN
@@ -0,0 +1,96 @@
+/* File: sweep.c
+ * -------------
+ * Implementation of the parameter-sweep thread pool. See sweep.h.
+ */
+
+#include "sweep.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <error.h>
+
+#include "bench.h"
+
+/* State shared by the workers of one sweep. Configurations are claimed by
+ * incrementing next; done[i] is set under lock when configuration i
+ * finishes, and the calling thread waits on finished for the next one it
+ * has to emit. */
+typedef struct {
+  int count;
+  sweep_work_fn work;
+  void *ctx;
+
+  int next;
+  bool *done;
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+} sweep_state;
+
+typedef struct {
+  sweep_state *s;
+  int id;
+} worker_arg;
+
+int sweep_default_threads(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0 ? n : 1);
+}
+
+static void *worker(void *arg) {
+  worker_arg *w = arg;
+  sweep_state *s = w->s;
+  bench_pin_cpu(w->id % sweep_default_threads()); // best effort
+
+  while(true) {
+    int i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+    if(i >= s->count) break;
+    s->work(i, s->ctx);
+
+    pthread_mutex_lock(&s->lock);
+    s->done[i] = true;
+    pthread_cond_broadcast(&s->finished);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+void sweep_run(int count, int nthreads, sweep_work_fn work, sweep_emit_fn emit, void *ctx) {
+  if(nthreads > count) nthreads = count;
+  if(nthreads <= 1) {
+    for(int i = 0; i < count; i++) {
+      work(i, ctx);
+      if(emit != NULL) emit(i, ctx);
+    }
+    return;
+  }
+
+  sweep_state s = { count, work, ctx, 0, calloc(count, sizeof(bool)) };
+  pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+  worker_arg *args = malloc(nthreads * sizeof(worker_arg));
+  if(s.done == NULL || threads == NULL || args == NULL) error(1,0, "out of memory starting sweep");
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_cond_init(&s.finished, NULL);
+
+  for(int k = 0; k < nthreads; k++) {
+    args[k] = (worker_arg){ &s, k };
+    if(pthread_create(&threads[k], NULL, worker, &args[k]) != 0)
+      error(1,0, "cannot create sweep worker thread");
+  }
+
+  // Emit results in order while later configurations are still running
+  for(int i = 0; i < count; i++) {
+    pthread_mutex_lock(&s.lock);
+    while(!s.done[i]) pthread_cond_wait(&s.finished, &s.lock);
+    pthread_mutex_unlock(&s.lock);
+    if(emit != NULL) emit(i, ctx);
+  }
+
+  for(int k = 0; k < nthreads; k++) pthread_join(threads[k], NULL);
+  pthread_cond_destroy(&s.finished);
+  pthread_mutex_destroy(&s.lock);
+  free(s.done);
+  free(threads);
+  free(args);
+}
@@ -0,0 +1,39 @@
+/* File: sweep.h
+ * -------------
+ * A small thread pool for parameter sweeps. The configurations of a sweep
+ * (e.g. one per epsilon) are independent, so they are handed out to worker
+ * threads one at a time, each working on private heaps and buffers. Results
+ * are collected by the calling thread strictly in configuration order, so
+ * a parallel sweep prints exactly what the serial one would.
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+/* Runs configuration i on a worker thread. */
+typedef void (*sweep_work_fn)(int i, void *ctx);
+
+/* Consumes the result of configuration i on the calling thread. */
+typedef void (*sweep_emit_fn)(int i, void *ctx);
+
+/**
+ * Function: sweep_default_threads
+ * -------------------------------
+ * Returns the number of online CPUs, the default size of a sweep's pool.
+ */
+int sweep_default_threads(void);
+
+/**
+ * Function: sweep_run
+ * -------------------
+ * Runs work(i, ctx) for every i in [0, count) on up to nthreads worker
+ * threads, taking configurations in increasing order, and calls
+ * emit(i, ctx) on the calling thread for i = 0, 1, ... as soon as
+ * configurations 0..i have all finished. emit may be NULL. With nthreads
+ * at most 1 everything runs on the calling thread. When several workers
+ * are used, worker k is pinned to CPU k (modulo the number of CPUs) so
+ * that concurrent timings do not migrate between cores.
+ */
+void sweep_run(int count, int nthreads, sweep_work_fn work, sweep_emit_fn emit, void *ctx);
+
+#endif // SWEEP_H
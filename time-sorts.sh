@@ -1,20 +1,19 @@
 # Tests sorting algorithms on arrays with sizes
 # that are powers of 10, from 1 to 10^maxpwr,
-# running ./sorts 5 times. 
+# letting the benchmark harness in ./sorts repeat
+# each measurement until its timing is stable.
 # Designed to show how disgustingly slow soft heaps
 # perform on basic algorithms.
+# Emits a single CSV table on stdout; pass "json"
+# as the first argument for JSON lines instead.
 maxpwr=8
 pwr=0
 nelems=1
+format=${1:-csv}
 
 until [ $pwr -ge `expr $maxpwr + 1` ]
 do
-    echo $nelems
-    for i in 1 2 3 4 5
-    do
-        ./sorts $nelems
-    done
-
+    ./sorts -f $format $nelems
     nelems=`expr $nelems \* 10`
     pwr=`expr $pwr + 1`
-done
+done | awk 'NR == 1 || !/^suite,/'
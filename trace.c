@@ -0,0 +1,262 @@
+/* File: trace.c
+ * -------------
+ * Trace recording (through the soft heap observer) and loading. See trace.h.
+ * Records are written in host byte order, which is little-endian on every
+ * machine we run on.
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <error.h>
+
+#include "softheap.h"
+
+/* On-disk header. */
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t nheaps;
+  uint32_t reserved;
+  uint64_t nrecords;
+} trace_header;
+
+static const char magic[4] = { 'S', 'H', 'T', 'R' };
+
+#define MAX_HEAP_IDS 65536
+
+/****************************************** HEAP ID TABLE ****************************************/
+
+/* Map from live heap pointers to trace ids: an open-addressing hash table
+ * with linear probing, so that lookups on every recorded operation are O(1). */
+typedef struct {
+  softheap **keys;
+  uint16_t *ids;
+  size_t cap, count;
+} id_table;
+
+static size_t hash_ptr(softheap *p, size_t cap) {
+  uint64_t x = (uint64_t)(uintptr_t)p;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  return x & (cap - 1);
+}
+
+static void table_put(id_table *t, softheap *p, uint16_t id);
+
+/* Double the table's capacity and rehash. */
+static void table_grow(id_table *t) {
+  id_table old = *t;
+  t->cap = (old.cap > 0 ? 2 * old.cap : 64);
+  t->count = 0;
+  t->keys = calloc(t->cap, sizeof(softheap *));
+  t->ids = malloc(t->cap * sizeof(uint16_t));
+  if(t->keys == NULL || t->ids == NULL) error(1,0, "out of memory growing trace id table");
+
+  for(size_t i = 0; i < old.cap; i++)
+    if(old.keys[i] != NULL) table_put(t, old.keys[i], old.ids[i]);
+  free(old.keys);
+  free(old.ids);
+}
+
+static void table_put(id_table *t, softheap *p, uint16_t id) {
+  if(2 * (t->count + 1) > t->cap) table_grow(t);
+  size_t i = hash_ptr(p, t->cap);
+  while(t->keys[i] != NULL && t->keys[i] != p) i = (i + 1) & (t->cap - 1);
+  if(t->keys[i] == NULL) t->count++;
+  t->keys[i] = p;
+  t->ids[i] = id;
+}
+
+/* Return the slot holding p, or -1. */
+static long table_find(const id_table *t, softheap *p) {
+  if(t->cap == 0) return -1;
+  size_t i = hash_ptr(p, t->cap);
+  while(t->keys[i] != NULL) {
+    if(t->keys[i] == p) return i;
+    i = (i + 1) & (t->cap - 1);
+  }
+  return -1;
+}
+
+/* Remove the entry in slot i, shifting later entries of its probe run back
+ * so that lookups never stop early at the hole. */
+static void table_remove_slot(id_table *t, size_t i) {
+  size_t mask = t->cap - 1, j = i;
+  t->keys[i] = NULL;
+  t->count--;
+  while(true) {
+    j = (j + 1) & mask;
+    if(t->keys[j] == NULL) return;
+    size_t home = hash_ptr(t->keys[j], t->cap);
+    // Move j into the hole at i unless its home lies cyclically in (i, j]
+    bool stays = (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+    if(stays) continue;
+    t->keys[i] = t->keys[j];
+    t->ids[i] = t->ids[j];
+    t->keys[j] = NULL;
+    i = j;
+  }
+}
+
+/******************************************** RECORDING ****************************************/
+
+/* State of the recording in progress. Recording is process-wide, matching
+ * the soft heap observer it is built on. */
+static struct {
+  FILE *f;
+  size_t nrecords;
+  id_table ids;
+  uint16_t *free_ids;   // stack of ids released by destroy/meld
+  int nfree;
+  int next_id;          // smallest id never handed out
+} rec;
+
+static uint16_t acquire_id(void) {
+  if(rec.nfree > 0) return rec.free_ids[--rec.nfree];
+  if(rec.next_id >= MAX_HEAP_IDS) error(1,0, "trace recorder: more than %d live heaps", MAX_HEAP_IDS);
+  return rec.next_id++;
+}
+
+static void release_id(uint16_t id) {
+  rec.free_ids[rec.nfree++] = id;
+}
+
+/* Return the id of heap p, which must have been created while recording. */
+static uint16_t lookup_id(softheap *p) {
+  long slot = table_find(&rec.ids, p);
+  if(slot < 0) error(1,0, "trace recorder: operation on a heap created before recording started");
+  return rec.ids.ids[slot];
+}
+
+static void emit(trace_op op, uint16_t heap, int32_t arg) {
+  trace_record r = { op, 0, heap, arg };
+  if(fwrite(&r, sizeof(r), 1, rec.f) != 1) error(1,0, "trace recorder: write failed");
+  rec.nrecords++;
+}
+
+/* The soft heap observer that turns operations into records. */
+static void record_event(const softheap_event *ev, void *ctx) {
+  switch(ev->op) {
+  case SH_OP_CREATE: {
+    uint16_t id = acquire_id();
+    table_put(&rec.ids, ev->heap, id);
+    float eps = softheap_epsilon(ev->heap);
+    int32_t bits;
+    memcpy(&bits, &eps, sizeof(bits));
+    emit(TRACE_CREATE, id, bits);
+    break;
+  }
+  case SH_OP_INSERT:
+    emit(TRACE_INSERT, lookup_id(ev->heap), ev->key);
+    break;
+  case SH_OP_EXTRACT:
+    emit(TRACE_EXTRACT, lookup_id(ev->heap), ev->key);
+    break;
+  case SH_OP_MELD: {
+    uint16_t dst = lookup_id(ev->heap), src = lookup_id(ev->other);
+    emit(TRACE_MELD, dst, src);
+    // The result is named dst from now on; src is dead.
+    table_remove_slot(&rec.ids, table_find(&rec.ids, ev->other));
+    if(ev->result != ev->heap) {
+      table_remove_slot(&rec.ids, table_find(&rec.ids, ev->heap));
+      table_put(&rec.ids, ev->result, dst);
+    }
+    release_id(src);
+    break;
+  }
+  case SH_OP_DESTROY: {
+    long slot = table_find(&rec.ids, ev->heap);
+    if(slot < 0) error(1,0, "trace recorder: destroying a heap created before recording started");
+    uint16_t id = rec.ids.ids[slot];
+    emit(TRACE_DESTROY, id, 0);
+    table_remove_slot(&rec.ids, slot);
+    release_id(id);
+    break;
+  }
+  }
+}
+
+/* Write the header for the records emitted so far at the start of the file. */
+static void write_header(void) {
+  trace_header h = { { 0 }, TRACE_VERSION, rec.next_id, 0, rec.nrecords };
+  memcpy(h.magic, magic, sizeof(magic));
+  fseek(rec.f, 0, SEEK_SET);
+  if(fwrite(&h, sizeof(h), 1, rec.f) != 1) error(1,0, "trace recorder: write failed");
+  fseek(rec.f, 0, SEEK_END);
+}
+
+bool trace_start_recording(const char *path) {
+  if(rec.f != NULL) return false;
+  FILE *f = fopen(path, "wb");
+  if(f == NULL) return false;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.f = f;
+  setvbuf(f, NULL, _IOFBF, 1 << 20); // records are tiny; write them out in large blocks
+  rec.free_ids = malloc(MAX_HEAP_IDS * sizeof(uint16_t));
+  if(rec.free_ids == NULL) error(1,0, "out of memory starting trace recording");
+  write_header();
+
+  softheap_set_observer(record_event, NULL);
+  return true;
+}
+
+size_t trace_stop_recording(void) {
+  if(rec.f == NULL) return 0;
+  softheap_set_observer(NULL, NULL);
+
+  write_header();
+  fclose(rec.f);
+  free(rec.ids.keys);
+  free(rec.ids.ids);
+  free(rec.free_ids);
+
+  size_t n = rec.nrecords;
+  memset(&rec, 0, sizeof(rec));
+  return n;
+}
+
+/******************************************** LOADING ****************************************/
+
+bool trace_load(const char *path, trace *t) {
+  FILE *f = fopen(path, "rb");
+  if(f == NULL) return false;
+
+  trace_header h;
+  if(fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, magic, sizeof(magic)) != 0 ||
+     h.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a version %d soft heap trace\n", path, TRACE_VERSION);
+    fclose(f);
+    return false;
+  }
+
+  t->nrecords = h.nrecords;
+  t->nheaps = h.nheaps;
+  t->records = malloc((h.nrecords > 0 ? h.nrecords : 1) * sizeof(trace_record));
+  if(t->records == NULL) error(1,0, "out of memory loading trace %s", path);
+  if(fread(t->records, sizeof(trace_record), h.nrecords, f) != h.nrecords) {
+    fprintf(stderr, "%s: truncated trace\n", path);
+    free(t->records);
+    fclose(f);
+    return false;
+  }
+
+  fclose(f);
+  return true;
+}
+
+void trace_free(trace *t) {
+  free(t->records);
+  t->records = NULL;
+  t->nrecords = 0;
+}
+
+double trace_epsilon(const trace_record *r) {
+  float eps;
+  memcpy(&eps, &r->arg, sizeof(eps));
+  return eps;
+}
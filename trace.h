@@ -0,0 +1,87 @@
+/* File: trace.h
+ * -------------
+ * Compact binary traces of priority queue operations, for recording a
+ * workload once (e.g. in production) and replaying it offline against any
+ * engine. A trace file is a 24-byte header followed by fixed 8-byte records:
+ *
+ *   header:  char magic[4] = "SHTR"; uint32 version; uint32 nheaps;
+ *            uint32 reserved; uint64 nrecords     (all little-endian)
+ *   record:  uint8 op; uint8 reserved; uint16 heap; int32 arg
+ *
+ * Heaps are named by small integer ids that are reused once a heap is
+ * destroyed or melded away; nheaps is one more than the largest id used.
+ * The meaning of arg depends on the operation (see trace_op).
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_VERSION 1
+
+typedef enum {
+  TRACE_CREATE,   // create heap; arg holds epsilon as IEEE float bits
+  TRACE_INSERT,   // insert arg into heap
+  TRACE_EXTRACT,  // extract-min from heap; arg is the element the recorder saw
+  TRACE_MELD,     // meld heap arg into heap; the result is named heap, arg is dead
+  TRACE_DESTROY   // destroy heap
+} trace_op;
+
+typedef struct {
+  uint8_t op;
+  uint8_t reserved;
+  uint16_t heap;
+  int32_t arg;
+} trace_record;
+
+/* A trace loaded into memory. */
+typedef struct {
+  trace_record *records;
+  size_t nrecords;
+  int nheaps;
+} trace;
+
+/**
+ * Function: trace_start_recording
+ * -------------------------------
+ * Starts recording every client-side soft heap operation (via the soft heap
+ * observer) into a new trace file at path. Returns false if the file cannot
+ * be created or a recording is already in progress. Heaps that already exist
+ * when recording starts are unknown to the trace and must not be used.
+ */
+bool trace_start_recording(const char *path);
+
+/**
+ * Function: trace_stop_recording
+ * ------------------------------
+ * Stops recording, finalizes the header, and closes the file. Returns the
+ * number of records written.
+ */
+size_t trace_stop_recording(void);
+
+/**
+ * Function: trace_load
+ * --------------------
+ * Reads the trace at path into t. Returns false (with errno set or a message
+ * on stderr for malformed files) on failure.
+ */
+bool trace_load(const char *path, trace *t);
+
+/**
+ * Function: trace_free
+ * --------------------
+ * Releases the memory of a loaded trace.
+ */
+void trace_free(trace *t);
+
+/**
+ * Function: trace_epsilon
+ * -----------------------
+ * Decodes the epsilon stored in a TRACE_CREATE record.
+ */
+double trace_epsilon(const trace_record *r);
+
+#endif // TRACE_H
@@ -0,0 +1,269 @@
+/* File: workload.c
+ * ----------------
+ * Implementation of the shared key generators. See workload.h.
+ */
+
+#include "workload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+/******************************************** PRNG ****************************************/
+
+/* Rotate x left by k bits. */
+static inline uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+/* One step of splitmix64, used only to expand seeds. */
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+void rng_seed(rng *g, uint64_t seed) {
+  for(int i = 0; i < 4; i++) g->s[i] = splitmix64(&seed);
+}
+
+uint64_t rng_next(rng *g) {
+  uint64_t *s = g->s;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
+}
+
+/* Lemire's nearly divisionless bounded generation. */
+uint64_t rng_below(rng *g, uint64_t bound) {
+  if(bound == 0) return 0;
+  unsigned __int128 m = (unsigned __int128)rng_next(g) * bound;
+  uint64_t lo = (uint64_t)m;
+  if(lo < bound) {
+    uint64_t threshold = -bound % bound;
+    while(lo < threshold) {
+      m = (unsigned __int128)rng_next(g) * bound;
+      lo = (uint64_t)m;
+    }
+  }
+  return (uint64_t)(m >> 64);
+}
+
+double rng_double(rng *g) {
+  return (rng_next(g) >> 11) * 0x1.0p-53;
+}
+
+/* Box-Muller transform. One of the pair of deviates is discarded, which
+ * keeps the generator stateless beyond the PRNG itself. */
+double rng_gaussian(rng *g) {
+  double u1 = 1.0 - rng_double(g); // in (0, 1] so the log is finite
+  double u2 = rng_double(g);
+  return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/***************************************** ZIPF SAMPLING **************************************/
+
+/* Rejection-inversion sampler for the Zipf distribution over [1, N] with
+ * exponent s (Hoermann and Derflinger, 1996). It needs O(1) setup and O(1)
+ * expected time per sample, so it works for universes far larger than any
+ * table we could precompute. */
+typedef struct {
+  double s, n;
+  double h_integral_x1, h_integral_n, threshold;
+} zipf_sampler;
+
+/* log1p(x)/x, continuous at 0. */
+static double helper1(double x) {
+  return (fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x / 3));
+}
+
+/* expm1(x)/x, continuous at 0. */
+static double helper2(double x) {
+  return (fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3));
+}
+
+static double zipf_h(const zipf_sampler *z, double x) {
+  return exp(-z->s * log(x));
+}
+
+static double zipf_h_integral(const zipf_sampler *z, double x) {
+  double logx = log(x);
+  return helper2((1 - z->s) * logx) * logx;
+}
+
+static double zipf_h_integral_inverse(const zipf_sampler *z, double x) {
+  double t = x * (1 - z->s);
+  if(t < -1) t = -1; // guard against rounding just outside the domain
+  return exp(helper1(t) * x);
+}
+
+static void zipf_init(zipf_sampler *z, long n, double s) {
+  z->s = s;
+  z->n = n;
+  z->h_integral_x1 = zipf_h_integral(z, 1.5) - 1;
+  z->h_integral_n = zipf_h_integral(z, n + 0.5);
+  z->threshold = 2 - zipf_h_integral_inverse(z, zipf_h_integral(z, 2.5) - zipf_h(z, 2));
+}
+
+static long zipf_sample(const zipf_sampler *z, rng *g) {
+  while(true) {
+    double u = z->h_integral_n + rng_double(g) * (z->h_integral_x1 - z->h_integral_n);
+    double x = zipf_h_integral_inverse(z, u);
+    long k = (long)(x + 0.5);
+    if(k < 1) k = 1;
+    else if(k > z->n) k = z->n;
+    if(k - x <= z->threshold || u >= zipf_h_integral(z, k + 0.5) - zipf_h(z, k)) return k;
+  }
+}
+
+/******************************************** GENERATORS ****************************************/
+
+/* Clamp a double into the range of non-negative ints. */
+static inline int clamp_key(double x) {
+  if(x < 0) return 0;
+  if(x > INT_MAX) return INT_MAX;
+  return (int)x;
+}
+
+/* Reverse the low nbits bits of x. */
+static inline uint64_t reverse_bits(uint64_t x, int nbits) {
+  uint64_t r = 0;
+  for(int i = 0; i < nbits; i++, x >>= 1) r = (r << 1) | (x & 1);
+  return r;
+}
+
+/* Gaussian clusters: param centers spread uniformly over the key range, each
+ * key drawn from a randomly chosen cluster with a spread small enough that
+ * clusters rarely overlap. */
+static void fill_gaussian(int *keys, size_t n, long nclusters, rng *g) {
+  double *centers = malloc(nclusters * sizeof(double));
+  if(centers == NULL) abort();
+  for(long c = 0; c < nclusters; c++) centers[c] = rng_double(g) * INT_MAX;
+  double sigma = (double)INT_MAX / (nclusters * 32);
+
+  for(size_t i = 0; i < n; i++) {
+    double center = centers[rng_below(g, nclusters)];
+    keys[i] = clamp_key(center + sigma * rng_gaussian(g));
+  }
+  free(centers);
+}
+
+/* Nearly sorted: start from 0..n-1 and pick k random positions whose values
+ * are rotated among themselves, so that (up to repeated picks) exactly k items
+ * end up out of place and everything else stays sorted. */
+static void fill_nearly_sorted(int *keys, size_t n, long k, rng *g) {
+  for(size_t i = 0; i < n; i++) keys[i] = i;
+  if(k < 2 || n < 2) return;
+
+  size_t first = rng_below(g, n), prev = first;
+  int carried = keys[first];
+  for(long j = 1; j < k; j++) {
+    size_t pos = rng_below(g, n);
+    keys[prev] = keys[pos];
+    prev = pos;
+  }
+  keys[prev] = carried;
+}
+
+/* Adversarial for the soft heap: the bit-reversal permutation. Every combine
+ * joins a tree built from one block of 2^k consecutive inserts with the tree
+ * built from the next block, and under bit reversal those two blocks hold
+ * perfectly interleaved keys at every level. Sift therefore keeps alternating
+ * between children, and each concatenated list spans the widest possible range
+ * of keys, which maximizes ckey inflation. */
+static void fill_adversarial(int *keys, size_t n) {
+  int nbits = 0;
+  while(((size_t)1 << nbits) < n) nbits++;
+  for(size_t i = 0; i < n; i++) keys[i] = (int)reverse_bits(i, nbits);
+}
+
+void workload_fill(int *keys, size_t n, const workload_spec *spec, rng *g) {
+  long param = spec->param;
+
+  switch(spec->dist) {
+  case DIST_UNIFORM:
+    for(size_t i = 0; i < n; i++) keys[i] = rng_next(g) >> 33;
+    break;
+  case DIST_SORTED:
+    for(size_t i = 0; i < n; i++) keys[i] = i;
+    break;
+  case DIST_REVERSE:
+    for(size_t i = 0; i < n; i++) keys[i] = n - 1 - i;
+    break;
+  case DIST_ORGAN_PIPE:
+    for(size_t i = 0; i < n; i++) keys[i] = (i < n / 2 ? i : n - 1 - i);
+    break;
+  case DIST_SAWTOOTH:
+    if(param <= 0) param = sqrt(n) > 2 ? sqrt(n) : 2;
+    for(size_t i = 0; i < n; i++) keys[i] = i % param;
+    break;
+  case DIST_FEW_UNIQUE:
+    if(param <= 0) param = 16;
+    for(size_t i = 0; i < n; i++) keys[i] = rng_below(g, param);
+    break;
+  case DIST_ZIPF: {
+    zipf_sampler z;
+    zipf_init(&z, param > 0 ? param : 1 << 20, spec->shape > 0 ? spec->shape : 1.0);
+    for(size_t i = 0; i < n; i++) keys[i] = zipf_sample(&z, g);
+    break;
+  }
+  case DIST_GAUSSIAN:
+    fill_gaussian(keys, n, param > 0 ? param : 16, g);
+    break;
+  case DIST_NEARLY_SORTED:
+    fill_nearly_sorted(keys, n, param > 0 ? param : (long)(n / 100), g);
+    break;
+  case DIST_ADVERSARIAL:
+    fill_adversarial(keys, n);
+    break;
+  default:
+    abort();
+  }
+}
+
+/******************************************** NAMING ****************************************/
+
+static const char *const names[DIST_COUNT] = {
+  "uniform", "sorted", "reverse", "organ-pipe", "sawtooth", "few-unique",
+  "zipf", "gaussian", "nearly-sorted", "adversarial"
+};
+
+const char *workload_name(key_dist dist) {
+  return (dist >= 0 && dist < DIST_COUNT ? names[dist] : "unknown");
+}
+
+bool workload_parse(const char *desc, workload_spec *spec) {
+  size_t len = strcspn(desc, ":");
+  for(int d = 0; d < DIST_COUNT; d++) {
+    if(strlen(names[d]) == len && strncmp(desc, names[d], len) == 0) {
+      spec->dist = d;
+      spec->param = 0;
+      spec->shape = 0;
+      if(desc[len] == ':') {
+        char *end;
+        spec->param = strtol(desc + len + 1, &end, 10);
+        if(*end == ':') spec->shape = strtod(end + 1, NULL);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+char *workload_describe(const workload_spec *spec, char *buf, size_t len) {
+  if(spec->shape > 0) snprintf(buf, len, "%s:%ld:%g", workload_name(spec->dist), spec->param, spec->shape);
+  else if(spec->param > 0) snprintf(buf, len, "%s:%ld", workload_name(spec->dist), spec->param);
+  else snprintf(buf, len, "%s", workload_name(spec->dist));
+  return buf;
+}
@@ -0,0 +1,110 @@
+/* File: workload.h
+ * ----------------
+ * Key generators shared by the benchmark drivers. Keys come from a fast
+ * xoshiro256** generator (so drivers can be seeded reproducibly and
+ * independently of rand()) and follow one of several distributions that
+ * show up in practice or stress particular parts of the soft heap. All
+ * generators write into a caller-provided buffer so that generation can
+ * happen in an untimed setup phase.
+ */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* State of a xoshiro256** pseudorandom generator. */
+typedef struct {
+  uint64_t s[4];
+} rng;
+
+/* Key distributions understood by workload_fill. */
+typedef enum {
+  DIST_UNIFORM,       // uniform in [0, 2^31), like rand()
+  DIST_SORTED,        // 0, 1, ..., n-1
+  DIST_REVERSE,       // n-1, ..., 1, 0
+  DIST_ORGAN_PIPE,    // ascending to the middle, then descending
+  DIST_SAWTOOTH,      // ascending runs of length param (default sqrt(n))
+  DIST_FEW_UNIQUE,    // uniform over param distinct values (default 16)
+  DIST_ZIPF,          // Zipf over [1, param] (default 2^20) with exponent shape (default 1)
+  DIST_GAUSSIAN,      // mixture of param Gaussian clusters (default 16)
+  DIST_NEARLY_SORTED, // sorted, then param items (default n/100) displaced
+  DIST_ADVERSARIAL,   // bit-reversal permutation; see workload.c
+  DIST_COUNT
+} key_dist;
+
+/* A distribution together with its optional parameters. A zero param
+ * or shape selects the distribution's default. */
+typedef struct {
+  key_dist dist;
+  long param;
+  double shape;
+} workload_spec;
+
+/**
+ * Function: rng_seed
+ * ------------------
+ * Initializes g from a 64-bit seed (expanded with splitmix64).
+ */
+void rng_seed(rng *g, uint64_t seed);
+
+/**
+ * Function: rng_next
+ * ------------------
+ * Returns the next 64 pseudorandom bits from g.
+ */
+uint64_t rng_next(rng *g);
+
+/**
+ * Function: rng_below
+ * -------------------
+ * Returns a uniformly distributed integer in [0, bound).
+ */
+uint64_t rng_below(rng *g, uint64_t bound);
+
+/**
+ * Function: rng_double
+ * --------------------
+ * Returns a uniformly distributed double in [0, 1).
+ */
+double rng_double(rng *g);
+
+/**
+ * Function: rng_gaussian
+ * ----------------------
+ * Returns a standard normal deviate.
+ */
+double rng_gaussian(rng *g);
+
+/**
+ * Function: workload_fill
+ * -----------------------
+ * Writes n keys drawn from the distribution described by spec into keys.
+ */
+void workload_fill(int *keys, size_t n, const workload_spec *spec, rng *g);
+
+/**
+ * Function: workload_name
+ * -----------------------
+ * Returns the short name of a distribution, as accepted by workload_parse.
+ */
+const char *workload_name(key_dist dist);
+
+/**
+ * Function: workload_parse
+ * ------------------------
+ * Parses a description of the form "name[:param[:shape]]", e.g. "zipf:1000:0.99",
+ * into spec. Returns false if the name is not recognized.
+ */
+bool workload_parse(const char *desc, workload_spec *spec);
+
+/**
+ * Function: workload_describe
+ * ---------------------------
+ * Writes the canonical "name[:param[:shape]]" form of spec into buf.
+ */
+char *workload_describe(const workload_spec *spec, char *buf, size_t len);
+
+#endif // WORKLOAD_H